@@ -0,0 +1,153 @@
+#!/bin/bash
+# Benchmark harness for inzunet, "make bench" runs it. Needs root, it loads and unloads the module for every run.
+#
+# For every CPU count and packet size it loads inzunet.ko with that many queues, drives traffic for DURATION seconds and
+# appends one CSV row per direction (lines starting with # record how each batch of rows was produced):
+#   version,mode,driver,cpus,size,seconds,packets,pps,bps,cpu_pct,cycles_per_packet
+#
+# TX is driven by the in-kernel generator (debugfs tx_gen, the default) or by the kernel's pktgen (TX_DRIVER=pktgen),
+# RX by the module's own NAPI injector at full speed (rx_pps=-1). cpu_pct is busy time over all CPUs from /proc/stat,
+# cycles_per_packet comes from "perf stat -a -e cycles" when perf is installed, otherwise from busy time times the
+# nominal clock, which is good enough to compare two builds on the same box but not two boxes.
+#
+# Everything is an environment variable so a run can be reproduced from the CSV's header comment:
+#   CPUS="1 2 4" SIZES="64 1500" DURATION=5 MODES="tx rx" TX_DRIVER=gen OUT=results.csv make bench
+# GSO_MAX_SIZE=<bytes> also sets gso_max_size/gso_ipv4_max_size (BIG TCP, above 65536) before every run, for TCP traffic
+# pushed through the device from outside the harness.
+set -euo pipefail
+
+HERE=$(cd "$(dirname "$0")/.." && pwd)
+MODULE=${MODULE:-$HERE/inzunet.ko}
+NCPU=$(nproc)
+CPUS=${CPUS:-"$(seq -s ' ' 1 "$NCPU")"}
+SIZES=${SIZES:-"64 128 256 512 1024 1500 4000 9000 16000 65000"} # TX sizes above 9000 need the 64K MTU, RX is capped at one page
+DURATION=${DURATION:-5}
+MODES=${MODES:-"tx rx"}
+TX_DRIVER=${TX_DRIVER:-gen}
+OUT=${OUT:-$HERE/bench/results.csv}
+EXTRA_PARAMS=${EXTRA_PARAMS:-} # passed to insmod as is, e.g. "lltx=1" or "offloads=0"
+VERSION=${VERSION:-$(git -C "$HERE" describe --always --dirty 2>/dev/null || echo unknown)}
+DEV=inzunet0
+DBG=/sys/kernel/debug/inzunet/$DEV
+
+die() { echo "inzunet-bench: $*" >&2; exit 1; }
+
+[ "$(id -u)" -eq 0 ] || die "must run as root"
+[ -f "$MODULE" ] || die "$MODULE not found, run make first"
+mountpoint -q /sys/kernel/debug || mount -t debugfs none /sys/kernel/debug
+
+unload() { rmmod inzunet 2>/dev/null || true; }
+trap unload EXIT
+
+# dev_stat <field>: one counter out of /proc/net/inzunet/<dev>
+dev_stat() { awk -F= -v k="$1" '$1 == k { print $2 }' "/proc/net/inzunet/$DEV"; }
+
+# busy and total jiffies summed over all CPUs
+cpu_times() { awk '/^cpu / { idle = $5 + $6; t = 0; for (i = 2; i <= NF; i++) t += $i; print t - idle, t }' /proc/stat; }
+
+cpu_hz() { awk -F: '/^cpu MHz/ { printf "%d\n", $2 * 1000000; exit }' /proc/cpuinfo; }
+
+have_perf() { command -v perf >/dev/null 2>&1; }
+
+# load <queues> <frame size> <module params...>: fails when the device can't take frames that big. The MTU goes on
+# before the link comes up because ndo_open sizes the RX template from it.
+load() {
+    local mtu=$(($2 - 14))
+    [ "$mtu" -lt 68 ] && mtu=68
+    unload
+    # shellcheck disable=SC2086
+    insmod "$MODULE" numqueues="$1" "${@:3}" $EXTRA_PARAMS
+    ip link set "$DEV" mtu "$mtu" 2>/dev/null || return 1
+    if [ -n "${GSO_MAX_SIZE:-}" ]; then
+        ip link set "$DEV" gso_max_size "$GSO_MAX_SIZE" gso_ipv4_max_size "$GSO_MAX_SIZE" 2>/dev/null ||
+            ip link set "$DEV" gso_max_size "$GSO_MAX_SIZE"
+    fi
+    ip link set "$DEV" up
+}
+
+pktgen_start() { # pktgen_start <cpus> <size>
+    modprobe pktgen
+    local cpu mac
+    mac=$(cat "/sys/class/net/$DEV/address")
+    for ((cpu = 0; cpu < $1; cpu++)); do
+        echo "rem_device_all" > "/proc/net/pktgen/kpktgend_$cpu"
+        echo "add_device $DEV@$cpu" > "/proc/net/pktgen/kpktgend_$cpu"
+        local pg=/proc/net/pktgen/$DEV@$cpu
+        for cmd in "count 0" "clone_skb 1000000" "pkt_size $(($2 - 4))" "delay 0" "dst 198.18.0.1" "dst_mac $mac" \
+                   "queue_map_min $cpu" "queue_map_max $cpu" "burst 32"; do
+            echo "$cmd" > "$pg"
+        done
+    done
+    echo start > /proc/net/pktgen/pgctrl &
+}
+
+pktgen_stop() {
+    echo stop > /proc/net/pktgen/pgctrl
+    wait
+    local t
+    for t in /proc/net/pktgen/kpktgend_*; do echo "rem_device_all" > "$t"; done
+}
+
+# measure <mode> <driver> <cpus> <size> <counter>: samples the counter and CPU time around DURATION seconds of load
+measure() {
+    local p0 p1 b0 b1 busy0 total0 busy1 total1 cycles="" perf_out
+    p0=$(dev_stat "$5_packets"); b0=$(dev_stat "$5_bytes")
+    read -r busy0 total0 < <(cpu_times)
+    if have_perf; then
+        perf_out=$(perf stat -a -x, -e cycles -- sleep "$DURATION" 2>&1 >/dev/null | awk -F, '/cycles/ { print $1; exit }')
+        [[ $perf_out =~ ^[0-9]+$ ]] && cycles=$perf_out
+    else
+        sleep "$DURATION"
+    fi
+    p1=$(dev_stat "$5_packets"); b1=$(dev_stat "$5_bytes")
+    read -r busy1 total1 < <(cpu_times)
+
+    local packets=$((p1 - p0)) bytes=$((b1 - b0)) busy=$((busy1 - busy0)) total=$((total1 - total0))
+    if [ -z "$cycles" ]; then
+        # jiffies are USER_HZ (100) in /proc/stat
+        cycles=$(awk -v b="$busy" -v hz="$(cpu_hz)" 'BEGIN { printf "%.0f\n", b / 100 * hz }')
+    fi
+    awk -v v="$VERSION" -v m="$1" -v d="$2" -v c="$3" -v s="$4" -v t="$DURATION" -v p="$packets" -v by="$bytes" \
+        -v bu="$busy" -v to="$total" -v cy="$cycles" 'BEGIN {
+        printf "%s,%s,%s,%d,%d,%d,%d,%.0f,%.0f,%.1f,%.1f\n", v, m, d, c, s, t, p, p / t, by * 8 / t,
+               to ? bu * 100 / to : 0, p ? cy / p : 0 }' >> "$OUT"
+}
+
+run_tx() { # run_tx <cpus> <size>
+    load "$1" "$2" || { echo "inzunet-bench: skip tx cpus=$1 size=$2, mtu too large for $DEV" >&2; return; }
+    if [ "$TX_DRIVER" = pktgen ]; then
+        pktgen_start "$1" "$2"
+    else
+        echo 0 > "$DBG/tx_gen_pps"
+        echo "$2" > "$DBG/tx_gen_size"
+        echo "$1" > "$DBG/tx_gen_threads"
+        echo 1 > "$DBG/tx_gen"
+    fi
+    sleep 1 # let the threads get going so the warmup isn't in the numbers
+    measure tx "$TX_DRIVER" "$1" "$2" tx
+    if [ "$TX_DRIVER" = pktgen ]; then pktgen_stop; else echo 0 > "$DBG/tx_gen"; fi
+}
+
+run_rx() { # run_rx <cpus> <size>
+    # the injector clamps frames to one page, the bytes column shows what was really generated
+    load "$1" "$2" rx_pps=-1 rx_size="$2" || { echo "inzunet-bench: skip rx cpus=$1 size=$2, mtu too large for $DEV" >&2; return; }
+    sleep 1
+    measure rx injector "$1" "$2" rx
+}
+
+mkdir -p "$(dirname "$OUT")"
+if [ ! -s "$OUT" ]; then
+    echo "version,mode,driver,cpus,size,seconds,packets,pps,bps,cpu_pct,cycles_per_packet" > "$OUT"
+fi
+echo "# $(date -u +%FT%TZ) $(uname -r) version=$VERSION CPUS=\"$CPUS\" SIZES=\"$SIZES\" DURATION=$DURATION TX_DRIVER=$TX_DRIVER GSO_MAX_SIZE=${GSO_MAX_SIZE:-} EXTRA_PARAMS=\"$EXTRA_PARAMS\"" >> "$OUT"
+
+for cpus in $CPUS; do
+    [ "$cpus" -le "$NCPU" ] || continue
+    for size in $SIZES; do
+        for mode in $MODES; do
+            echo "inzunet-bench: $mode cpus=$cpus size=$size" >&2
+            "run_$mode" "$cpus" "$size"
+        done
+    done
+done
+echo "inzunet-bench: results in $OUT" >&2
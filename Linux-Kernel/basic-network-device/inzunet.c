@@ -1,6 +1,35 @@
 // Day 1 - Basic network device. We will create a virtual network device which is more basic and easier to implement than a real network device.
 // Day 2 - Adds atomic counters and /proc stats
 // Day 3 - Add fake rx injection so we can do receiving logic
+// Day 4 - Move counters to per-CPU u64_stats so xmit never bounces a shared cache line, add ndo_get_stats64
+// Day 5 - Multi-queue TX, one netdev_queue per CPU with XPS so senders on different CPUs never share a qdisc lock
+// Day 6 - Optional lockless (LLTX + noqueue) transmit so inzunet can be a pure sink for benchmarking the stack above it
+// Day 7 - Silent hot path: tracepoints instead of a pr_info per packet, plus an opt-in rate limited log behind a static key
+// Day 8 - Batch transmit completion using xmit_more, free a whole burst at once and update the counters once per burst
+// Day 9 - The Day 3 rx injection for real: one NAPI instance per queue generating synthetic frames, paced by an hrtimer or flat out
+// Day 10 - RX frames live in recycled page_pool pages wrapped with napi_build_skb, no allocator on the RX hot path
+// Day 11 - Pair mode like veth: inzunet0 and inzunet1 are wired together, TX on one is RX on the other through a per-queue ring
+// Day 12 - Our own cache line padded SPSC ring for the pair handoff, with stop/wake backpressure instead of dropping when full
+// Day 13 - Native XDP: attached programs run on synthetic RX frames right in the NAPI poll, before any skb exists
+// Day 14 - ndo_xdp_xmit, other devices can XDP_REDIRECT into us and we sink the frames a whole bulk at a time
+// Day 15 - Advertise SG/checksum/TSO/GSO offloads so the stack hands us whole super packets, optionally counted per segment
+// Day 16 - GRO friendly RX profiles: many TCP flows with in order sequence numbers, set in debugfs, and the GRO merge ratio
+// Day 17 - RSS: Toeplitz hashed flows land on the queue the indirection table picks, ethtool -x/-X shows and sets the table
+// Day 18 - ethtool -S with device and per-queue counters, read straight from the per-CPU stats like ndo_get_stats64
+// Day 19 - numdevs devices (or pairs) per load, each with its own /proc/net/inzunet/<ifname>
+// Day 20 - rtnl_link_ops, "ip link add type inzunet" creates devices in any netns, each netns gets its own /proc/net/inzunet/
+// Day 21 - Per-CPU log2 latency histograms for TX (since skb->tstamp) and RX (since the frame was due), with p50/p99/p999
+// Day 22 - Built in TX generator, one kthread per CPU pushing reused skbs through dev_queue_xmit, started from debugfs
+// Day 23 - AF_XDP zero-copy, an XSK pool per queue that the RX injector writes into and whose TX ring NAPI drains in bulk
+// Day 24 - MTU up to 64K with ndo_change_mtu, and BIG TCP so GSO skbs may grow past 64K
+// Day 25 - Emulated hardware timestamps, SIOCSHWTSTAMP/get_ts_info, TX stamps from xmit and RX stamps from when a frame was due
+// Day 26 - Emulated link rate and delay for sink mode, a per-queue token bucket that stops the queue and an hrtimer that wakes it
+// Day 27 - Byte Queue Limits, TX completion is the emulated wire finishing an skb or the pair peer taking it off the ring
+// Day 28 - Sampled packet capture, every Kth packet's first N bytes into per-CPU rings userspace mmaps from /dev/inzunet_capture
+// Day 29 - TX traffic mix counters by EtherType and L4 protocol, from fields the stack already set
+// Day 30 - NUMA local per-queue state, each queue, its ring and flow table on its CPU's node, queue_cpu settable in debugfs
+// Day 31 - Threaded NAPI and busy polling, queues linked to their NAPI so SO_BUSY_POLL apps can find and poll them
+// Day 32 - Cheap create/delete churn, RX pools built on first open and destroyed from a workqueue, no grace period per NAPI
 #include <linux/module.h>
 #include <linux/kernel.h>
 #include <linux/netdevice.h> // provides net_device struct and related functionality
@@ -10,95 +39,3406 @@
 #include <linux/proc_fs.h> // provides proc_create and remove_proc_entry, api for creating and managing /proc filesystem entries
 #include <linux/seq_file.h> // provides seq_file, api for seq_file which is convenient way for kernel modules to implement readable /proc or /sys files
 #include <linux/atomic.h> // provides atomic code, api for atomic operations which allow safely reading, writing, and modifying concurrently without using locks
-#include <linux/timer.h> // provides timer
+#include <linux/percpu.h> // provides alloc_percpu/this_cpu_ptr, api for giving every CPU its own copy of a variable
+#include <linux/u64_stats_sync.h> // provides u64_stats_t and u64_stats_sync, lets readers see consistent 64 bit counters even on 32 bit machines
+#include <linux/cpumask.h> // provides cpumask and num_online_cpus, used to build the XPS CPU to queue mapping
+#include <linux/slab.h> // provides kcalloc, kzalloc_node and kfree
+#include <linux/moduleparam.h> // provides module_param, lets you pass options at load time like "insmod inzunet.ko numqueues=4"
+#include <linux/version.h> // provides LINUX_VERSION_CODE, for the few places the kernel api changed under us. Needs 6.8 or later
+// (page_pool_params.netdev, ethtool_rxfh_param), so only changes since then are guarded
+#include <linux/jump_label.h> // provides static keys, a branch the kernel patches in or out at runtime so a disabled check costs nothing
+#include <linux/net.h> // provides net_ratelimit
+#include <linux/log2.h> // provides ilog2, used to bucket batch sizes
+#include <linux/hrtimer.h> // provides hrtimer, high resolution timers, used to pace the RX injector
+#include <linux/ktime.h> // provides ktime_get_ns
+#include <linux/math64.h> // provides mul_u64_u32_div, 64 bit math that is safe on 32 bit machines
+#include <linux/smp.h> // provides smp_call_function_single, runs a function on a chosen CPU
+#include <linux/ip.h> // provides struct iphdr
+#include <linux/ipv6.h> // provides ipv6_hdr
+#include <linux/udp.h> // provides struct udphdr
+#include <linux/tcp.h> // provides tcp_hdrlen, used to work out the headers a GSO packet repeats on every segment
+#include <net/ip.h> // provides ip_send_check, computes the IPv4 header checksum
+#include <net/page_pool/helpers.h> // provides page_pool, a per-queue recycling page allocator for RX buffers (needs CONFIG_PAGE_POOL)
+#include <linux/mm.h> // provides kvzalloc_node/kvfree, kmalloc that falls back to vmalloc for big rings
+#include <linux/rcupdate.h> // provides rcu_dereference/rcu_assign_pointer, used for the peer pointer
+#include <linux/rtnetlink.h> // provides rtnl_lock, the big lock that serializes network device configuration
+#include <linux/bpf.h> // provides bpf_prog and netdev_bpf, what ndo_bpf gets handed when someone attaches an XDP program
+#include <linux/filter.h> // provides bpf_prog_run_xdp and xdp_do_redirect
+#include <linux/bpf_trace.h> // provides trace_xdp_exception, must come before CREATE_TRACE_POINTS below or we'd define it ourselves
+#include <net/xdp.h> // provides xdp_buff and xdp_rxq_info
+#include <net/xdp_sock_drv.h> // provides xsk_buff_alloc and the XSK TX ring api, what a zero-copy AF_XDP driver uses
+#include <linux/debugfs.h> // provides debugfs_create_dir/u32/bool, knobs under /sys/kernel/debug that need no parsing code
+#include <net/checksum.h> // provides csum_partial and csum_tcpudp_magic
+#include <linux/ethtool.h> // provides ethtool_ops, what the ethtool command talks to
+#include <linux/list.h> // provides list_head, the list of devices we created
+#include <net/net_namespace.h> // provides struct net and pernet_operations, every netns has its own /proc/net
+#include <net/netns/generic.h> // provides net_generic, per netns storage for modules
+#include <net/rtnetlink.h> // provides rtnl_link_ops, what "ip link add type inzunet" talks to
+#include <linux/mutex.h> // provides mutex, guards the latency histogram baseline
+#include <linux/fs.h> // provides file_operations, for the debugfs reset file
+#include <linux/kthread.h> // provides kthread_create_on_node/kthread_stop, the TX generator threads
+#include <linux/sched.h> // provides cond_resched
+#include <linux/delay.h> // provides usleep_range
+#include <linux/net_tstamp.h> // provides hwtstamp_config and the HWTSTAMP_* and SOF_TIMESTAMPING_* constants
+#include <linux/uaccess.h> // provides copy_from_user, for the debugfs files we parse ourselves
+#include <linux/miscdevice.h> // provides misc_register, a char device without having to allocate a major number
+#include <linux/vmalloc.h> // provides vmalloc_user/remap_vmalloc_range, memory we can map into userspace
+#include <linux/workqueue.h> // provides alloc_workqueue/queue_work, frees dead devices' page pools off the unregister path
 // Note: A lot of these header files' code is indirectly included from other already included header files, however, standard is to always include all the
 // header files you are using explicitly.
 
+// CREATE_TRACE_POINTS makes this one include of inzunet_trace.h emit the tracepoint definitions instead of just declarations.
+// The Makefile adds our own directory to the include path so the tracing macros can re-read the header.
+#define CREATE_TRACE_POINTS
+#include "inzunet_trace.h"
+
 #define PROC_NAME "inzunet_stats" // defines name of proc file, it will appear as /proc/inzunet_stats
+#define PROC_DIR_NAME "inzunet" // /proc/net/inzunet/, one file per device named after it
+#define INZUNET_MAX_DEVS 64 // upper bound for numdevs
+#define INZUNET_GEN_POOL 64 // skbs each TX generator thread builds once and keeps reusing
+#define INZUNET_GEN_BURST 64 // most skbs a generator thread sends before checking the clock and kthread_should_stop again
+#define INZUNET_LAT_BUCKETS 32 // latency histogram buckets, bucket b counts [2^(b-1), 2^b) ns, the last one everything from ~1s up
+#define INZUNET_MAX_QUEUES 256 // upper bound for numqueues, plenty for any box we run on and keeps /proc output readable
+#define INZUNET_TX_BATCH_MAX 64 // flush a TX batch after this many skbs even if the stack says more are coming
+#define INZUNET_BATCH_BUCKETS (ilog2(INZUNET_TX_BATCH_MAX) + 1) // batch size histogram buckets: 1, 2-3, 4-7, ... 64
+#define INZUNET_RX_MIN_TICK_NS (20 * NSEC_PER_USEC) // fastest the RX pacing timer fires, higher rates just generate more frames per tick
+#define INZUNET_RX_POOL_SIZE 1024 // pages each RX queue's page_pool keeps ready for recycling
+#define INZUNET_RING_MAX 65536 // upper bound for ring_size
+// TX traffic mix buckets, see inzunet_tx_classify
+enum { INZUNET_L3_IPV4, INZUNET_L3_IPV6, INZUNET_L3_ARP, INZUNET_L3_OTHER, INZUNET_L3_MAX };
+enum { INZUNET_L4_TCP, INZUNET_L4_UDP, INZUNET_L4_ICMP, INZUNET_L4_MAX };
+#define INZUNET_LINK_OVERHEAD 24 // preamble, start of frame delimiter, FCS and inter frame gap, what every frame costs on a real wire
+#define INZUNET_LINK_AHEAD_NS (50 * NSEC_PER_USEC) // token bucket depth, how far ahead of the emulated wire a queue may get before it stops
+#define INZUNET_LINK_DELAY_MAX 65536 // skbs one queue may hold for link_delay_us, more are freed right away
+#define INZUNET_LINK_COALESCE_NS (20 * NSEC_PER_USEC) // TX completion moderation, the delay timer fires at most this often
+#define INZUNET_RX_HEADROOM XDP_PACKET_HEADROOM // space left in front of each RX frame, XDP programs may grow headers into it
+// biggest frame that fits in one page next to the headroom and the skb_shared_info napi_build_skb puts at the end of the buffer
+#define INZUNET_RX_MAX_FRAME (PAGE_SIZE - INZUNET_RX_HEADROOM - SKB_DATA_ALIGN(sizeof(struct skb_shared_info)))
+// synthetic RX frames come "from" this made up link partner, addresses are from 198.18.0.0/15 which RFC 2544 reserves for benchmarking
+#define INZUNET_RX_SADDR 0xc6120001 // 198.18.0.1
+#define INZUNET_RX_DADDR 0xc6120002 // 198.18.0.2
+#define INZUNET_RX_PORT 9 // discard port, the destination of every synthetic frame
+#define INZUNET_RX_FLOW_PORT 10000 // flow f comes from source port INZUNET_RX_FLOW_PORT + f
+#define INZUNET_RX_MAX_FLOWS 16384 // per queue, caps the debugfs rx_flows knob
+#define INZUNET_RSS_KEY_SIZE 40 // bytes, the usual Toeplitz key length, enough for an IPv6 4-tuple
+#define INZUNET_RSS_INDIR_SIZE 128 // indirection table entries, the low 7 bits of the hash pick one
+static const u8 inzunet_rx_src_mac[ETH_ALEN] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 }; // locally administered address
+
+// module parameters, shown under /sys/module/inzunet/parameters/. 0444 means readable by everyone but only settable at load time.
+static unsigned int numqueues; // 0 means pick one queue per online CPU at load time
+module_param(numqueues, uint, 0444);
+MODULE_PARM_DESC(numqueues, "Number of TX/RX queues (default 0 = one per online CPU)");
+
+// how many devices to create at load time, with pair=1 that many pairs
+static unsigned int numdevs = 1;
+module_param(numdevs, uint, 0444);
+MODULE_PARM_DESC(numdevs, "Number of devices (or pairs with pair=1) to create at load, 0 = only via ip link add (default 1)");
+
+// which CPU each queue's NAPI and RX timer run on, like setting a NIC's IRQ affinity. "queue_cpu=2,4,6" puts queue 0 on CPU 2
+// and so on, queues past the end of the list (or given an offline CPU) keep the default spread over online CPUs. A queue's
+// memory is allocated on its CPU's node, debugfs queue_cpu can move a queue later while the device is down.
+static int queue_cpu[INZUNET_MAX_QUEUES];
+static int queue_cpu_count;
+module_param_array(queue_cpu, int, &queue_cpu_count, 0444);
+MODULE_PARM_DESC(queue_cpu, "Comma separated CPU for each RX queue's NAPI (default one per online CPU, spread over nodes)");
+
+// Lockless transmit. Normally the core takes the TX queue's lock (HARD_TX_LOCK) around every ndo_start_xmit and runs the packet through a qdisc first.
+// Our xmit only touches per-CPU counters so it doesn't need that lock, and a sink never needs to queue, so with lltx=1 we ask for both to be skipped.
+// Measure it with pktgen ("queue_xmit" mode) against the device once with lltx=0 and once with lltx=1, the difference is the qdisc + lock cost per packet.
+static bool lltx;
+module_param(lltx, bool, 0444);
+MODULE_PARM_DESC(lltx, "Lockless transmit: skip the TX lock and use the noqueue qdisc (default 0)");
+
+// Three ways to run the same RX poll, for comparing their latency on identical injector traffic:
+//  softirq     the default, the pacing timer (our "interrupt") schedules the NAPI and it runs in NET_RX softirq on the queue's CPU
+//  threaded    napi_threaded=1, or "echo 1 > /sys/class/net/<dev>/threaded" at any time. Each queue's poll runs in its own
+//              "napi/<dev>-<napi_id>" kthread the scheduler places, taskset it onto the queue's cpu= for a like for like run
+//  busy poll   an application with SO_BUSY_POLL (or net.core.busy_poll) calls our poll itself from recvmsg/epoll, it finds the
+//              NAPI from the napi_id GRO stamps on every skb we deliver. The injector makes whatever frames are due whenever
+//              it's polled, so the busy poller sees them without waiting for the timer. With SO_PREFER_BUSY_POLL and the
+//              device's napi_defer_hard_irqs/gro_flush_timeout set, napi_complete_done keeps the NAPI to itself and the timer's
+//              napi_schedule does nothing, just like a NIC whose interrupt stays masked.
+static bool napi_threaded;
+module_param(napi_threaded, bool, 0444);
+MODULE_PARM_DESC(napi_threaded, "Create devices with threaded NAPI, one kthread per queue instead of softirq (default 0)");
+
+// Rate limited per packet logging for debugging. Printing every packet through printk costs far more than the rest of xmit,
+// so instead of testing a bool on every packet we flip a static key, while it's off the check is a patched out jump.
+static DEFINE_STATIC_KEY_FALSE(inzunet_log_key);
+static bool log_packets;
+
+// custom setter so writing /sys/module/inzunet/parameters/log_packets (or passing it at load) also flips the static key
+static int inzunet_log_packets_set(const char *val, const struct kernel_param *kp)
+{
+    int err = param_set_bool(val, kp);
+
+    if (err)
+        return err;
+    if (log_packets)
+        static_branch_enable(&inzunet_log_key);
+    else
+        static_branch_disable(&inzunet_log_key);
+    return 0;
+}
+
+static const struct kernel_param_ops inzunet_log_packets_ops = {
+    .set = inzunet_log_packets_set,
+    .get = param_get_bool,
+};
+module_param_cb(log_packets, &inzunet_log_packets_ops, &log_packets, 0644);
+MODULE_PARM_DESC(log_packets, "Log packets to dmesg, rate limited by net_ratelimit (default 0)");
+
+// Latency histograms. Reading the clock costs a few tens of ns per packet, so like log_packets it's a static key that is
+// a patched out jump while off. Writable at runtime through /sys/module/inzunet/parameters/latency.
+static DEFINE_STATIC_KEY_FALSE(inzunet_lat_key);
+static bool latency;
+
+static int inzunet_latency_set(const char *val, const struct kernel_param *kp)
+{
+    int err = param_set_bool(val, kp);
+
+    if (err)
+        return err;
+    if (latency)
+        static_branch_enable(&inzunet_lat_key);
+    else
+        static_branch_disable(&inzunet_lat_key);
+    return 0;
+}
+
+static const struct kernel_param_ops inzunet_latency_ops = {
+    .set = inzunet_latency_set,
+    .get = param_get_bool,
+};
+module_param_cb(latency, &inzunet_latency_ops, &latency, 0644);
+MODULE_PARM_DESC(latency, "Record TX and RX latency histograms (default 0)");
+
+// Sampled capture. Every capture_every-th packet a CPU sends or receives has its first capture_snaplen bytes copied into that
+// CPU's ring, which userspace reads by mmapping /dev/inzunet_capture, no syscall or socket per packet like tcpdump. Another
+// static key, so it costs nothing while off. The rings are allocated the first time capture is turned on and stay until
+// unload, a process may still have them mapped after capture goes off again.
+//
+// The mapping is one region per possible CPU, CPU c's at c * INZUNET_CAP_CPU_BYTES. Each region starts with a page holding
+// struct inzunet_cap_ctl, then INZUNET_CAP_SLOTS records of INZUNET_CAP_SLOT bytes, struct inzunet_cap_rec followed by data.
+// Record i lives in slot i % nslots and the ring just overwrites, a reader that can't keep up loses the oldest records, never
+// slows down the data path. A record is valid once its seq is i + 1 (low 32 bits): read seq, copy, read seq again, keep it
+// if both match, the producer zeroes seq before rewriting a slot.
+#define INZUNET_CAP_SLOT 256
+#define INZUNET_CAP_SLOTS 1024
+#define INZUNET_CAP_CPU_BYTES (PAGE_SIZE + INZUNET_CAP_SLOTS * INZUNET_CAP_SLOT)
+#define INZUNET_CAP_TX 0
+#define INZUNET_CAP_RX 1
+
+struct inzunet_cap_ctl {
+    u64 head; // records started so far, the newest is head - 1
+    u32 nslots;
+    u32 slot_size;
+};
+
+struct inzunet_cap_rec {
+    u32 seq; // record index + 1 once complete, 0 while being written
+    u32 ifindex;
+    u64 ts_ns; // CLOCK_MONOTONIC
+    u32 len; // whole packet
+    u16 caplen; // bytes of it in data[]
+    u16 queue;
+    u8 dir; // INZUNET_CAP_TX or INZUNET_CAP_RX
+    u8 pad[7];
+    u8 data[];
+};
+#define INZUNET_CAP_SNAP_MAX (INZUNET_CAP_SLOT - sizeof(struct inzunet_cap_rec))
+
+static DEFINE_STATIC_KEY_FALSE(inzunet_cap_key);
+static bool capture;
+static void *inzunet_cap_buf; // vmalloc_user, nr_cpu_ids regions
+static DEFINE_PER_CPU(unsigned int, inzunet_cap_skip); // packets left to skip before the next sample
+
+static int inzunet_capture_set(const char *val, const struct kernel_param *kp)
+{
+    int err = param_set_bool(val, kp);
+    unsigned int cpu;
+
+    if (err)
+        return err;
+    if (!capture) {
+        static_branch_disable(&inzunet_cap_key);
+        return 0;
+    }
+    // param writes are serialized by the module's param lock, and at load time they run before inzunet_init
+    if (!inzunet_cap_buf) {
+        void *buf = vmalloc_user((size_t)nr_cpu_ids * INZUNET_CAP_CPU_BYTES); // zeroed
+
+        if (!buf) {
+            capture = false;
+            return -ENOMEM;
+        }
+        for_each_possible_cpu(cpu) {
+            struct inzunet_cap_ctl *ctl = buf + (size_t)cpu * INZUNET_CAP_CPU_BYTES;
+
+            ctl->nslots = INZUNET_CAP_SLOTS;
+            ctl->slot_size = INZUNET_CAP_SLOT;
+        }
+        inzunet_cap_buf = buf; // the key below is what makes the data path look at it
+    }
+    static_branch_enable(&inzunet_cap_key);
+    return 0;
+}
+
+// "capture=1" on the insmod line has already allocated the rings by the time inzunet_init runs, so both a failed init and
+// module exit give them back here. Nothing can be capturing any more: no device is left, and an open /dev/inzunet_capture
+// or a mapping of it holds a module reference.
+static void inzunet_cap_free(void)
+{
+    static_branch_disable(&inzunet_cap_key);
+    vfree(inzunet_cap_buf);
+    inzunet_cap_buf = NULL;
+}
+
+static const struct kernel_param_ops inzunet_capture_ops = {
+    .set = inzunet_capture_set,
+    .get = param_get_bool,
+};
+module_param_cb(capture, &inzunet_capture_ops, &capture, 0644);
+MODULE_PARM_DESC(capture, "Sample packets into the /dev/inzunet_capture rings (default 0)");
+static unsigned int capture_snaplen = 128;
+module_param(capture_snaplen, uint, 0644);
+MODULE_PARM_DESC(capture_snaplen, "Bytes captured from the start of each sampled packet, at most 224 (default 128)");
+static unsigned int capture_every = 1;
+module_param(capture_every, uint, 0644);
+MODULE_PARM_DESC(capture_every, "Sample one packet in this many, per CPU (default 1 = all)");
+
+// Pair mode, like a veth pair: the module creates inzunet0 and inzunet1 and whatever one transmits the other receives.
+// Gives an in kernel end to end path (socket -> TX stack -> RX stack -> socket) with no hardware in the way.
+static bool pair;
+module_param(pair, bool, 0444);
+MODULE_PARM_DESC(pair, "Create two devices wired back to back, TX on one is RX on the other (default 0)");
+
+// Offloads. With these on the stack stops segmenting and checksumming in software before xmit, a TCP sender hands us 64K super
+// packets instead of 1500 byte ones. They are in hw_features too, so "ethtool -K inzunet0 tso off" etc. toggles them at runtime.
+static bool offloads = true;
+module_param(offloads, bool, 0444);
+MODULE_PARM_DESC(offloads, "Start with SG/HW_CSUM/TSO/GSO offloads enabled (default 1)");
+
+// With offloads on one skb can stand for dozens of wire packets. gso_accounting=1 counts each GSO skb as the gso_segs
+// packets it would have been segmented into, and adds the headers every segment repeats to the byte count, so tx/rx stats
+// match what a real NIC would have put on the wire. With it off an skb is a packet, so the numbers show what the stack did.
+static bool gso_accounting;
+module_param(gso_accounting, bool, 0644);
+MODULE_PARM_DESC(gso_accounting, "Count GSO skbs as the segments they stand for (default 0)");
+
+static unsigned int ring_size = 256;
+module_param(ring_size, uint, 0444);
+MODULE_PARM_DESC(ring_size, "Pair mode ring depth per queue in skbs, rounded up to a power of 2 (default 256)");
+
+// Link emulation, sink mode only. A real NIC can only put link_mbps on the wire and stops its queue when the TX ring fills,
+// that backpressure is what qdiscs, BQL, TSQ and fq pacing are built around and what an infinitely fast sink never shows.
+// Each queue is its own link (so with several queues the device as a whole can go faster), use numqueues=1 for one shared link.
+// link_delay_us holds every skb that long after it "left" before freeing it, so socket memory and TSQ see a real round trip.
+// Both are defaults for new devices, /sys/kernel/debug/inzunet/<name>/link_* change them for the next ip link set up.
+static unsigned int link_mbps;
+module_param(link_mbps, uint, 0444);
+MODULE_PARM_DESC(link_mbps, "Emulated link rate per TX queue in Mbit/s, 0 = unlimited (default 0)");
+static unsigned int link_delay_us;
+module_param(link_delay_us, uint, 0444);
+MODULE_PARM_DESC(link_delay_us, "Fixed delay before a transmitted skb is freed, in microseconds (default 0)");
+
+// RX injector defaults, every device copies these when it is created
+static int rx_pps; // per queue, 0 turns the injector off
+module_param(rx_pps, int, 0444);
+MODULE_PARM_DESC(rx_pps, "Synthetic RX frames per second per queue, 0 = off, -1 = as fast as NAPI can go (default 0)");
+static unsigned int rx_size = ETH_ZLEN;
+module_param(rx_size, uint, 0444);
+MODULE_PARM_DESC(rx_size, "Synthetic RX frame length in bytes including the Ethernet header (default 60)");
+static unsigned short rx_proto = ETH_P_IP;
+module_param(rx_proto, ushort, 0444);
+MODULE_PARM_DESC(rx_proto, "EtherType of synthetic RX frames, 0x0800 builds IPv4/UDP, anything else gets a zero payload (default 0x0800)");
+
+// per-CPU counters. Every CPU only ever writes its own copy so the hot path needs no atomics and no shared cache line,
+// readers (ndo_get_stats64, /proc) walk all CPUs and add them up. syncp lets a reader detect it raced a writer and retry,
+// on 64 bit kernels it compiles away to nothing.
+// A CPU can be both sending on a queue (xmit) and receiving on it (NAPI poll), both run in softirq/BH disabled context so they
+// never interrupt each other and can share one syncp, as long as we never call into the stack inside a write section.
+struct inzunet_pcpu_stats {
+    u64_stats_t tx_packets;
+    u64_stats_t tx_bytes;
+    u64_stats_t tx_batch_hist[INZUNET_BATCH_BUCKETS]; // how many skbs each freed TX batch had, log2 buckets
+    u64_stats_t tx_dropped; // pair mode, the peer was down or its ring was full
+    u64_stats_t tx_ring_full; // pair mode, times we filled the peer's ring and had to stop this TX queue
+    u64_stats_t tx_link_stops; // link emulation, times the queue got too far ahead of the wire and was stopped
+    u64_stats_t tx_link_stopped_ns; // and how long it stayed stopped in total
+    // TX traffic mix, in packets like tx_packets. Every packet has one L3 bucket, only IPv4/IPv6 ones can have an L4 one.
+    u64_stats_t tx_ipv4;
+    u64_stats_t tx_ipv6;
+    u64_stats_t tx_arp;
+    u64_stats_t tx_other;
+    u64_stats_t tx_tcp;
+    u64_stats_t tx_udp;
+    u64_stats_t tx_icmp;
+    u64_stats_t rx_packets;
+    u64_stats_t rx_bytes;
+    u64_stats_t rx_dropped; // synthetic frames we owed but couldn't allocate an skb for
+    u64_stats_t rx_ring_wakeups; // pair mode, times draining our ring restarted the peer's stopped TX queue
+    u64_stats_t rx_gro_merged; // RX skbs GRO folded into an earlier one, rx_packets - rx_gro_merged is what the stack really saw
+    // what the XDP program decided for each synthetic frame, frames it passed are also counted in rx_packets
+    u64_stats_t xdp_pass;
+    u64_stats_t xdp_drop;
+    u64_stats_t xdp_tx;
+    u64_stats_t xdp_redirect;
+    u64_stats_t xdp_aborted; // XDP_ABORTED, unknown verdicts and failed redirects
+    // frames other devices XDP_REDIRECTed to us through ndo_xdp_xmit, kept apart from tx_* since they never were skbs
+    u64_stats_t xdp_xmit_packets;
+    u64_stats_t xdp_xmit_bytes;
+    u64_stats_t xdp_xmit_bulks; // ndo_xdp_xmit calls, xdp_xmit_packets / xdp_xmit_bulks is the average bulk size
+    // descriptors an AF_XDP socket put on its TX ring and we completed, zero-copy never makes an skb so they aren't tx_*
+    u64_stats_t xsk_tx_packets;
+    u64_stats_t xsk_tx_bytes;
+    struct u64_stats_sync syncp;
+};
+
+// latency histograms, per-CPU per device and written from the same BH context as the stats, so the same rules apply
+struct inzunet_pcpu_lat {
+    u64_stats_t tx[INZUNET_LAT_BUCKETS]; // skb->tstamp to ndo_start_xmit
+    u64_stats_t rx[INZUNET_LAT_BUCKETS]; // frame due (injector) or enqueued by the peer (pair) to handing it to the stack
+    struct u64_stats_sync syncp;
+};
+
+// plain snapshot of the histograms, summed over every CPU
+struct inzunet_lat {
+    u64 tx[INZUNET_LAT_BUCKETS];
+    u64 rx[INZUNET_LAT_BUCKETS];
+};
+
+// TX generator settings, debugfs knobs, read when the generator starts
+struct inzunet_gen_config {
+    u32 pps; // per thread, 0 = as fast as dev_queue_xmit takes them
+    u32 size; // frame length including the Ethernet header
+    u32 threads; // 0 = one per online CPU
+};
+
+// one TX generator thread. Only the thread writes the counters, readers use the syncp like for every other counter.
+struct inzunet_gen {
+    struct net_device *dev;
+    struct task_struct *task;
+    unsigned int cpu;
+    u64 start_ns;
+    u64 stop_ns; // 0 while running
+    u64_stats_t packets;
+    u64_stats_t bytes;
+    u64_stats_t errors; // dev_queue_xmit said dropped or congested
+    u64_stats_t busy; // every reusable skb was still in flight (queued in a qdisc) so we had to back off
+    struct u64_stats_sync syncp;
+};
+
+// pair mode, what we keep in skb->cb between the peer's xmit and our NAPI. The skb is ours in between, the qdisc is done
+// with cb by the time xmit runs and GRO only starts using it once we hand the skb up.
+struct inzunet_skb_cb {
+    u64 enq_ns; // when the peer put it in our ring, 0 if latency was off then
+    u64 due_ns; // sink mode link delay, when the skb may be freed
+    unsigned int bql_len; // what netdev_tx_sent_queue was told, the completion has to give back the same
+};
+#define INZUNET_SKB_CB(skb) ((struct inzunet_skb_cb *)(skb)->cb)
+
+// Single producer, single consumer ring of skbs for the pair mode handoff. Indexes are free running and only masked when used,
+// so head - tail is always the occupancy. Each side's index lives on its own cache line together with a cached copy of the other
+// side's index, the producer only reads the consumer's line when its cached copy says the ring looks full (and vice versa), so
+// in steady state each side's cache line stays in its own CPU's cache. No locks and no atomics, just acquire/release ordering.
+struct inzunet_ring {
+    // producer side, written only by the peer's xmit (serialized by its TX queue lock)
+    unsigned int head ____cacheline_aligned_in_smp;
+    unsigned int cached_tail;
+    // consumer side, written only by our NAPI poll
+    unsigned int tail ____cacheline_aligned_in_smp;
+    unsigned int cached_head;
+    // set once at init, read by both
+    struct sk_buff **slots ____cacheline_aligned_in_smp;
+    unsigned int mask; // size - 1
+};
+
+// one of these per queue. Each queue keeps its own per-CPU counters so we can report per-queue numbers and
+// still never have two CPUs write the same cache line. ____cacheline_aligned_in_smp keeps neighbouring queues apart.
+struct inzunet_queue {
+    struct inzunet_priv *priv; // back pointer to the device this queue belongs to
+    unsigned int index; // queue number, matches the netdev_queue index
+    struct inzunet_pcpu_stats __percpu *stats;
+
+    // RX side, only touched by this queue's NAPI poll (the core guarantees a NAPI instance only polls on one CPU at a time)
+    struct napi_struct napi;
+    struct hrtimer rx_timer; // schedules the NAPI every tick when the injector is paced
+    unsigned int cpu; // CPU this queue's timer and NAPI run on
+    u64 rx_start_ns; // pacing origin, we owe rx_pps * (now - rx_start_ns) frames
+    u64 rx_sent; // frames generated since rx_start_ns
+    struct inzunet_rx_flow *rx_flows; // flows RSS steered to this queue, allocated in ndo_open
+    unsigned int rx_nflows; // how many of rx_flows are in use, fewer than asked for if we ran out of source ports
+    unsigned int rx_flow; // flow the next frame belongs to
+    unsigned int rx_burst_left; // frames left before moving on to the next flow
+    struct page_pool *page_pool; // RX buffers, created on the first ndo_open, NULL until then. See inzunet_free_queue_mem
+    struct work_struct free_work; // destroys page_pool and frees the queue once the device is gone
+    struct xdp_rxq_info xdp_rxq; // tells XDP which device/queue a frame came in on and that its memory belongs to page_pool
+    // AF_XDP zero-copy, set while a socket is bound to this queue. Only changed with the NAPI disabled, so the poll can use
+    // it without locking. xsk_rxq is the rxq info for frames in the pool's UMEM, the same queue but a different memory model.
+    struct xsk_buff_pool *xsk_pool;
+    struct xdp_rxq_info xsk_rxq;
+    // link emulation, written by xmit under the TX queue lock and read by the timers, which only run while the queue is stopped
+    // (link_timer) or hold the link_delayed lock (delay_timer)
+    u64 link_next_ns; // when the emulated wire is done sending everything accepted so far
+    u64 link_stop_ns; // when xmit last stopped the queue
+    struct hrtimer link_timer; // wakes the queue once the wire has caught up
+    struct hrtimer delay_timer; // frees link_delayed skbs as they become due
+    struct sk_buff_head link_delayed; // oldest first, due times only ever grow. Everything in it is BQL in flight.
+    // pair mode: skbs the peer transmitted on its queue with the same index, waiting for our NAPI. The peer's TX queue lock
+    // serializes the producer and our NAPI is the only consumer.
+    struct inzunet_ring ring;
+} ____cacheline_aligned_in_smp;
+
+// plain (non per-CPU) snapshot of the counters, what a reader ends up with after summing every CPU
+struct inzunet_stats {
+    u64 tx_packets;
+    u64 tx_bytes;
+    u64 tx_batch_hist[INZUNET_BATCH_BUCKETS];
+    u64 tx_dropped;
+    u64 tx_ring_full;
+    u64 tx_link_stops;
+    u64 tx_link_stopped_ns;
+    u64 tx_ipv4;
+    u64 tx_ipv6;
+    u64 tx_arp;
+    u64 tx_other;
+    u64 tx_tcp;
+    u64 tx_udp;
+    u64 tx_icmp;
+    u64 rx_packets;
+    u64 rx_bytes;
+    u64 rx_dropped;
+    u64 rx_ring_wakeups;
+    u64 rx_gro_merged;
+    u64 xdp_pass;
+    u64 xdp_drop;
+    u64 xdp_tx;
+    u64 xdp_redirect;
+    u64 xdp_aborted;
+    u64 xdp_xmit_packets;
+    u64 xdp_xmit_bytes;
+    u64 xdp_xmit_bulks;
+    u64 xsk_tx_packets;
+    u64 xsk_tx_bytes;
+};
+
+// the counters ethtool -S reports, once for the whole device and once per queue as "queue<N>_<name>". Every entry is a u64
+// in struct inzunet_stats so adding a counter to ethtool is one line here. tx_batch_hist is reported separately, device wide only.
+struct inzunet_stat_desc {
+    char name[ETH_GSTRING_LEN];
+    size_t offset;
+};
+
+#define INZUNET_STAT(field) { #field, offsetof(struct inzunet_stats, field) }
+static const struct inzunet_stat_desc inzunet_stat_descs[] = {
+    INZUNET_STAT(tx_packets),
+    INZUNET_STAT(tx_bytes),
+    INZUNET_STAT(tx_dropped),
+    INZUNET_STAT(tx_ring_full),
+    INZUNET_STAT(tx_link_stops),
+    INZUNET_STAT(tx_link_stopped_ns),
+    INZUNET_STAT(tx_ipv4),
+    INZUNET_STAT(tx_ipv6),
+    INZUNET_STAT(tx_arp),
+    INZUNET_STAT(tx_other),
+    INZUNET_STAT(tx_tcp),
+    INZUNET_STAT(tx_udp),
+    INZUNET_STAT(tx_icmp),
+    INZUNET_STAT(rx_packets),
+    INZUNET_STAT(rx_bytes),
+    INZUNET_STAT(rx_dropped),
+    INZUNET_STAT(rx_ring_wakeups),
+    INZUNET_STAT(rx_gro_merged),
+    INZUNET_STAT(xdp_pass),
+    INZUNET_STAT(xdp_drop),
+    INZUNET_STAT(xdp_tx),
+    INZUNET_STAT(xdp_redirect),
+    INZUNET_STAT(xdp_aborted),
+    INZUNET_STAT(xdp_xmit_packets),
+    INZUNET_STAT(xdp_xmit_bytes),
+    INZUNET_STAT(xdp_xmit_bulks),
+    INZUNET_STAT(xsk_tx_packets),
+    INZUNET_STAT(xsk_tx_bytes),
+};
+#define INZUNET_NUM_STATS ARRAY_SIZE(inzunet_stat_descs)
+
+// what the RX injector generates, one per device
+struct inzunet_rx_config {
+    int pps; // per queue, 0 off, -1 flat out
+    unsigned int size; // frame length including the Ethernet header
+    u16 proto; // EtherType, host byte order
+    // flow profile, set through debugfs and picked up at the next ndo_open
+    u32 flows; // distinct flows per queue, each one its own source port
+    u32 burst; // back to back frames from one flow before switching, GRO can only merge frames that arrive together
+    bool tcp; // TCP segments with in order sequence numbers instead of UDP datagrams
+};
+
+// one synthetic flow. seq and ip_id are what it has sent so far, so the next segment carries on where the last left off and
+// GRO sees an in order stream.
+struct inzunet_rx_flow {
+    u32 hash; // Toeplitz hash of the 4-tuple, what a NIC would report in its RX descriptor
+    u32 seq;
+    u16 ip_id;
+    u16 sport; // host byte order
+};
+
+// skbs xmit has accepted but not freed yet. The stack sets xmit_more while it has more packets lined up for us, so we hold on
+// to the skbs, and when the burst ends free them all in one go and bump the counters once. This is per-CPU rather than per queue
+// because xmit_more itself is per-CPU, and with lltx two CPUs can be inside xmit for the same queue at once.
+struct inzunet_tx_batch {
+    struct inzunet_queue *q; // queue the pending skbs were sent on, a burst never spans queues
+    struct sk_buff *head; // pending skbs, chained through skb->next
+    unsigned int count; // skbs, what the batch size histogram and INZUNET_TX_BATCH_MAX look at
+    unsigned int packets; // what tx_packets gets, more than count when gso_accounting splits GSO skbs into segments
+    u64 bytes;
+    unsigned int dropped;
+    unsigned int ring_full;
+    unsigned int link_stops;
+    unsigned int l3[INZUNET_L3_MAX]; // traffic mix, added to tx_ipv4.. and tx_tcp.. at flush
+    unsigned int l4[INZUNET_L4_MAX];
+    struct inzunet_queue *peer_rq; // pair mode, the peer RX queue to wake once the burst is in its ring
+    unsigned int lat_count; // latency samples in lat
+    unsigned int lat[INZUNET_LAT_BUCKETS];
+};
+
+// what one NAPI poll delivered, added to the counters once at the end of the poll
+struct inzunet_rx_tally {
+    unsigned int packets;
+    u64 bytes;
+    unsigned int dropped;
+    unsigned int ring_wakeups;
+    unsigned int gro_merged;
+    unsigned int xdp_pass;
+    unsigned int xdp_drop;
+    unsigned int xdp_tx;
+    unsigned int xdp_redirect;
+    unsigned int xdp_aborted;
+    unsigned int xsk_tx_packets;
+    u64 xsk_tx_bytes;
+    bool xsk_fill_empty; // ran out of buffers on the XSK fill queue
+    unsigned int lat_count;
+    unsigned int lat[INZUNET_LAT_BUCKETS];
+};
+
+// we define this structure and will use it for the net_device private area below
+struct inzunet_priv {
+    struct net_device *dev;
+    unsigned int num_queues; // same as dev->real_num_tx_queues and dev->real_num_rx_queues
+    // num_queues pointers, each queue is its own allocation on the NUMA node of the CPU that services it. Allocated in ndo_init,
+    // freed in ndo_uninit
+    struct inzunet_queue **queues;
+    struct inzunet_tx_batch __percpu *tx_batch; // allocated in ndo_init, freed in ndo_uninit
+    // pair mode, the other end. Both devices always have the same number of queues so TX queue n feeds exactly the peer's RX queue n.
+    // Set before registration, cleared in ndo_uninit, xmit reads it under the RCU read lock dev_queue_xmit holds.
+    struct net_device __rcu *peer;
+    // attached XDP program or NULL, swapped under rtnl by ndo_bpf, read under RCU by the NAPI poll
+    struct bpf_prog __rcu *xdp_prog;
+
+    struct inzunet_rx_config rx;
+    u64 rx_tick_ns; // pacing timer period, derived from rx.pps
+    u8 *rx_template; // the synthetic frame, built in ndo_open and copied into every RX skb
+    unsigned int rx_len; // bytes of rx_template actually used
+    // the flow profile ndo_open took from rx, the NAPI polls only look at these so debugfs writes can't race them
+    unsigned int rx_burst;
+    bool rx_per_flow; // IPv4 frames, they belong to a flow and get patched after the template copy
+    // RSS, set through ethtool -X under rtnl, flows are steered with them at the next ndo_open
+    u8 rss_key[INZUNET_RSS_KEY_SIZE];
+    u32 rss_indir[INZUNET_RSS_INDIR_SIZE]; // hash & (INZUNET_RSS_INDIR_SIZE - 1) -> RX queue
+    struct dentry *debugfs; // /sys/kernel/debug/inzunet/<name>/, see inzunet_debugfs_add for <name>
+    struct proc_dir_entry *proc; // /proc/net/inzunet/<name>
+    struct inzunet_pcpu_lat __percpu *lat; // allocated in ndo_init, freed in ndo_uninit
+    // what the histograms held at the last reset, readers subtract it. The per-CPU counters themselves are never zeroed
+    // since only their own CPU may write them.
+    struct inzunet_lat lat_base;
+    struct mutex lat_lock; // guards lat_base
+    // TX generator, gen is the last (or current) run's threads, kept after they stop so their results stay readable
+    struct inzunet_gen_config gen_cfg;
+    struct inzunet_gen *gen;
+    unsigned int gen_count;
+    bool gen_running;
+    struct mutex gen_lock; // guards gen, gen_count and gen_running
+    struct list_head list; // on inzunet_devs while registered
+    // emulated hardware timestamping, changed under rtnl by SIOCSHWTSTAMP and read locklessly by xmit and NAPI
+    bool hwts_tx; // HWTSTAMP_TX_ON
+    bool hwts_rx; // HWTSTAMP_FILTER_ALL
+    // link emulation settings (debugfs, used at the next ndo_open) and the copy ndo_open took, which is what xmit reads
+    struct {
+        u32 mbps;
+        u32 delay_us;
+    } link;
+    u32 link_mbps;
+    u64 link_delay_ns;
+};
+
+// every registered inzunet device in every netns, whether module load or ip link add created it, in creation order. Only
+// changed under rtnl: added after register_netdevice, removed in ndo_uninit. The net_devices themselves are freed by the
+// core once unregistered (needs_free_netdev), nobody else keeps them.
+static LIST_HEAD(inzunet_devs);
+static struct proc_dir_entry *inzunet_proc_entry; // holds to /proc/inzunet_stats file entry for cleanup, shows the first device
+
+// per netns state, net_generic(net, inzunet_net_id) finds it
+static unsigned int inzunet_net_id;
+struct inzunet_net {
+    struct proc_dir_entry *proc_dir; // /proc/net/inzunet/ as seen from inside this netns
+};
+
+// Netlink attributes for "ip link add ... type inzunet", nested in IFLA_INFO_DATA. iproute2 doesn't know them, so they're
+// for tools that build their own netlink messages (pyroute2 and friends), plain ip link add gets the defaults.
+enum {
+    IFLA_INZUNET_UNSPEC,
+    IFLA_INZUNET_QUEUES, // u32, queues to use, at most the numtxqueues/numrxqueues the device was allocated with
+    IFLA_INZUNET_RX_PPS, // s32, same as the rx_pps module parameter
+    IFLA_INZUNET_MODE, // u32, one of enum inzunet_mode
+    __IFLA_INZUNET_MAX
+};
+#define IFLA_INZUNET_MAX (__IFLA_INZUNET_MAX - 1)
+
+enum inzunet_mode {
+    INZUNET_MODE_SINK, // a device that drops everything it sends, the default unless pair=1
+    INZUNET_MODE_PAIR, // creates a peer too, like a veth pair
+};
+
+static struct rtnl_link_ops inzunet_link_ops;
+static struct dentry *inzunet_debugfs_root; // /sys/kernel/debug/inzunet/, one directory per device below it
+static struct workqueue_struct *inzunet_wq; // frees dead devices' queues and page pools, see inzunet_free_queue_mem
+
+// --- capture ---
+
+// copies the start of skb (data must point at the Ethernet header) into this CPU's capture ring if it's the one in
+// capture_every to sample. Called with BH disabled (xmit, NAPI). Netpoll may xmit from hardirq in the middle of it, so the
+// slot is reserved with irqs off and every writer gets its own slot, the seq handshake covers the rest.
+static void inzunet_cap(const struct sk_buff *skb, const struct net_device *dev, unsigned int queue, u8 dir)
+{
+    unsigned int every = READ_ONCE(capture_every);
+    struct inzunet_cap_ctl *ctl;
+    struct inzunet_cap_rec *rec;
+    unsigned long flags;
+    unsigned int caplen;
+    u64 idx;
+
+    if (every > 1) {
+        if (this_cpu_read(inzunet_cap_skip)) {
+            this_cpu_dec(inzunet_cap_skip);
+            return;
+        }
+        this_cpu_write(inzunet_cap_skip, every - 1);
+    }
+
+    ctl = inzunet_cap_buf + (size_t)smp_processor_id() * INZUNET_CAP_CPU_BYTES;
+    local_irq_save(flags);
+    idx = ctl->head;
+    WRITE_ONCE(ctl->head, idx + 1);
+    local_irq_restore(flags);
+
+    rec = (void *)ctl + PAGE_SIZE + (idx % INZUNET_CAP_SLOTS) * INZUNET_CAP_SLOT;
+    WRITE_ONCE(rec->seq, 0);
+    smp_wmb(); // a reader that sees the new data also sees seq 0, pairs with the reader's read barrier
+    caplen = min3(skb->len, READ_ONCE(capture_snaplen), (unsigned int)INZUNET_CAP_SNAP_MAX);
+    rec->ifindex = dev->ifindex;
+    rec->ts_ns = ktime_get_ns();
+    rec->len = skb->len;
+    rec->caplen = caplen;
+    rec->queue = queue;
+    rec->dir = dir;
+    if (skb_copy_bits(skb, 0, rec->data, caplen)) // handles paged and GSO skbs too
+        rec->caplen = 0;
+    smp_wmb(); // the record is complete before it's marked valid
+    WRITE_ONCE(rec->seq, (u32)(idx + 1));
+}
+
+// /dev/inzunet_capture, read only mapping of every CPU's ring
+static int inzunet_cap_mmap(struct file *file, struct vm_area_struct *vma)
+{
+    if (!READ_ONCE(inzunet_cap_buf))
+        return -ENODEV; // turn capture on first, the rings don't exist before that
+    if (vma->vm_flags & VM_WRITE)
+        return -EPERM;
+    vm_flags_clear(vma, VM_MAYWRITE); // and no mprotect to writable later
+    return remap_vmalloc_range(vma, inzunet_cap_buf, vma->vm_pgoff); // checks the range fits
+}
+
+static const struct file_operations inzunet_cap_fops = {
+    .owner = THIS_MODULE, // a mapping holds the file, the file holds the module, so the rings outlive every mapping
+    .mmap  = inzunet_cap_mmap,
+};
+
+static struct miscdevice inzunet_cap_dev = {
+    .minor = MISC_DYNAMIC_MINOR,
+    .name  = "inzunet_capture",
+    .fops  = &inzunet_cap_fops,
+    .mode  = 0400,
+};
+
+// --- latency ---
+
+static unsigned int inzunet_lat_bucket(u64 ns)
+{
+    return min_t(unsigned int, fls64(ns), INZUNET_LAT_BUCKETS - 1);
+}
+
+// adds a poll's or a TX batch's samples to this CPU's histogram and clears them
+static void inzunet_lat_flush(struct inzunet_priv *priv, unsigned int *lat, bool tx)
+{
+    struct inzunet_pcpu_lat *pl = this_cpu_ptr(priv->lat);
+    u64_stats_t *hist = tx ? pl->tx : pl->rx;
+    unsigned int b;
+
+    u64_stats_update_begin(&pl->syncp);
+    for (b = 0; b < INZUNET_LAT_BUCKETS; b++) {
+        if (lat[b]) {
+            u64_stats_add(&hist[b], lat[b]);
+            lat[b] = 0;
+        }
+    }
+    u64_stats_update_end(&pl->syncp);
+}
+
+// whether skb->tstamp is a CLOCK_MONOTONIC delivery time (TCP stamps every skb with one) rather than a realtime receive
+// timestamp we can't compare with ktime_get_ns. 6.11 turned the single bit into a clock id.
+static bool inzunet_skb_tstamp_mono(const struct sk_buff *skb)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 11, 0)
+    return skb->tstamp_type == SKB_CLOCK_MONOTONIC;
+#else
+    return skb->mono_delivery_time;
+#endif
+}
+
+// TX latency, how long the skb spent between the socket stamping it and us, which is the qdisc plus the TX stack
+static void inzunet_tx_lat(const struct sk_buff *skb, struct inzunet_tx_batch *batch)
+{
+    u64 ts, now;
+
+    if (!skb->tstamp || !inzunet_skb_tstamp_mono(skb))
+        return; // no usable stamp, UDP and raw sockets don't set one
+    ts = ktime_to_ns(skb->tstamp);
+    now = ktime_get_ns();
+    if (now < ts)
+        return; // a departure time in the future, set by a pacing qdisc like fq
+    batch->lat[inzunet_lat_bucket(now - ts)]++;
+    batch->lat_count++;
+}
+
+static void inzunet_rx_lat(struct inzunet_rx_tally *tally, u64 since)
+{
+    u64 now = ktime_get_ns();
+
+    if (now < since)
+        return;
+    tally->lat[inzunet_lat_bucket(now - since)]++;
+    tally->lat_count++;
+}
+
+// sums every CPU's histograms and takes off the baseline from the last reset
+static void inzunet_read_lat(struct inzunet_priv *priv, struct inzunet_lat *tot, bool since_reset)
+{
+    unsigned int b;
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        const struct inzunet_pcpu_lat *pl = per_cpu_ptr(priv->lat, cpu);
+        struct inzunet_lat snap;
+        unsigned int start;
+
+        do {
+            start = u64_stats_fetch_begin(&pl->syncp);
+            for (b = 0; b < INZUNET_LAT_BUCKETS; b++) {
+                snap.tx[b] = u64_stats_read(&pl->tx[b]);
+                snap.rx[b] = u64_stats_read(&pl->rx[b]);
+            }
+        } while (u64_stats_fetch_retry(&pl->syncp, start));
+
+        for (b = 0; b < INZUNET_LAT_BUCKETS; b++) {
+            tot->tx[b] += snap.tx[b];
+            tot->rx[b] += snap.rx[b];
+        }
+    }
+    if (!since_reset)
+        return;
+    mutex_lock(&priv->lat_lock);
+    for (b = 0; b < INZUNET_LAT_BUCKETS; b++) {
+        tot->tx[b] -= priv->lat_base.tx[b];
+        tot->rx[b] -= priv->lat_base.rx[b];
+    }
+    mutex_unlock(&priv->lat_lock);
+}
+
+// the upper edge of the bucket holding the permille-th sample, so "p99<=4096" means 99% of samples took under 4096 ns
+static u64 inzunet_lat_percentile(const u64 *hist, u64 count, unsigned int permille)
+{
+    u64 rank = div_u64(count * permille + 999, 1000); // rounded up, so p999 of 10 samples is the 10th
+    u64 seen = 0;
+    unsigned int b;
+
+    for (b = 0; b < INZUNET_LAT_BUCKETS; b++) {
+        seen += hist[b];
+        if (seen >= rank)
+            break;
+    }
+    return b ? 1ULL << min(b, INZUNET_LAT_BUCKETS - 1U) : 0;
+}
+
+// --- pair ring ---
+
+static int inzunet_ring_init(struct inzunet_ring *r, unsigned int size, int node)
+{
+    r->slots = kvzalloc_node(array_size(size, sizeof(*r->slots)), GFP_KERNEL, node);
+    if (!r->slots)
+        return -ENOMEM;
+    r->mask = size - 1;
+    return 0;
+}
+
+// frees the ring and any skbs still in it, safe on a zeroed ring
+static void inzunet_ring_cleanup(struct inzunet_ring *r)
+{
+    if (!r->slots)
+        return;
+    while (r->tail != r->head)
+        kfree_skb(r->slots[r->tail++ & r->mask]);
+    kvfree(r->slots);
+    r->slots = NULL;
+}
+
+// free slots as the producer sees them, only refreshes the consumer's index when the cached one says we're out of room
+static unsigned int inzunet_ring_space(struct inzunet_ring *r)
+{
+    unsigned int size = r->mask + 1;
+
+    if (r->head - r->cached_tail < size)
+        return size - (r->head - r->cached_tail);
+    r->cached_tail = smp_load_acquire(&r->tail); // pairs with the release in inzunet_ring_consume_done
+    return size - (r->head - r->cached_tail);
+}
+
+// producer, caller must have checked inzunet_ring_space
+static void inzunet_ring_produce(struct inzunet_ring *r, struct sk_buff *skb)
+{
+    r->slots[r->head & r->mask] = skb;
+    smp_store_release(&r->head, r->head + 1); // the slot write is visible before the consumer can see the new head
+}
+
+// consumer, how many skbs are ready. Like inzunet_ring_space it only reads the producer's line when it has to.
+static unsigned int inzunet_ring_ready(struct inzunet_ring *r)
+{
+    if (r->cached_head == r->tail)
+        r->cached_head = smp_load_acquire(&r->head); // pairs with the release in inzunet_ring_produce
+    return r->cached_head - r->tail;
+}
+
+// consumer, hands back n slots in one store instead of one per skb
+static void inzunet_ring_consume_done(struct inzunet_ring *r, unsigned int n)
+{
+    smp_store_release(&r->tail, r->tail + n);
+}
+
+// a stopped sender is only restarted once this many slots are free, so a sender hovering at full doesn't stop and wake on every packet
+static unsigned int inzunet_ring_wake_thresh(const struct inzunet_ring *r)
+{
+    return (r->mask + 1) / 4;
+}
+
+// how full the ring is right now, for stats only so it doesn't matter that the two reads aren't atomic together
+static unsigned int inzunet_ring_count(const struct inzunet_ring *r)
+{
+    return READ_ONCE(r->head) - READ_ONCE(r->tail);
+}
+
+// --- RX injector ---
+// Every queue has a NAPI instance. NAPI is how real NICs receive: the interrupt only schedules the poll function, and the poll function
+// then pulls up to "budget" packets per call in softirq context. We have no interrupt, so either an hrtimer schedules the poll every
+// tick (paced mode) or the poll keeps itself scheduled by always using its whole budget (flat out). The poll builds synthetic frames
+// and hands them to the stack with napi_gro_receive, exactly where a NIC driver would.
+
+// how many packets and bytes an skb counts as. Without gso_accounting that is 1 and skb->len. With it a GSO skb counts as
+// gso_segs packets, and every segment after the first repeats the Ethernet/IP/TCP (or UDP) headers on the wire. The headers
+// are measured from the MAC header so this works on TX and on the pair RX side after eth_type_trans pulled the Ethernet header.
+// __inzunet_skb_wire always does the GSO math, the link emulation needs the real wire size whatever the counters show.
+static unsigned int __inzunet_skb_wire(const struct sk_buff *skb, unsigned int len, u64 *bytes)
+{
+    const struct skb_shared_info *shinfo = skb_shinfo(skb);
+    unsigned int segs, hdr_len;
+
+    *bytes = len;
+    if (!skb_is_gso(skb))
+        return 1;
+    segs = shinfo->gso_segs;
+    hdr_len = skb_transport_header(skb) - skb_mac_header(skb);
+    if (shinfo->gso_type & (SKB_GSO_TCPV4 | SKB_GSO_TCPV6))
+        hdr_len += tcp_hdrlen(skb);
+    else if (shinfo->gso_type & SKB_GSO_UDP_L4)
+        hdr_len += sizeof(struct udphdr);
+    if (segs > 1)
+        *bytes += (u64)(segs - 1) * hdr_len;
+    return max(segs, 1U);
+}
+
+static unsigned int inzunet_skb_wire(const struct sk_buff *skb, unsigned int len, u64 *bytes)
+{
+    if (!gso_accounting) {
+        *bytes = len;
+        return 1;
+    }
+    return __inzunet_skb_wire(skb, len, bytes);
+}
+
+// writes the frame every RX skb starts as into buf, returns its length
+static unsigned int inzunet_rx_build_template(const struct inzunet_priv *priv, u8 *buf)
+{
+    unsigned int len = priv->rx.size;
+    struct ethhdr *eth = (struct ethhdr *)buf;
+    struct iphdr *iph;
+    struct udphdr *udph;
+    struct tcphdr *tcph;
+
+    ether_addr_copy(eth->h_dest, priv->dev->dev_addr); // addressed to us so the stack treats it as PACKET_HOST
+    ether_addr_copy(eth->h_source, inzunet_rx_src_mac);
+    eth->h_proto = htons(priv->rx.proto);
+    if (priv->rx.proto != ETH_P_IP)
+        return len; // no L3 we know how to build, the payload stays zero
+
+    iph = (struct iphdr *)(eth + 1);
+    iph->version = 4;
+    iph->ihl = sizeof(*iph) / 4;
+    iph->tot_len = htons(len - ETH_HLEN);
+    iph->ttl = 64;
+    iph->saddr = htonl(INZUNET_RX_SADDR);
+    iph->daddr = htonl(INZUNET_RX_DADDR);
+
+    if (priv->rx.tcp) {
+        // a bare ACK carrying data, no PSH so GRO keeps merging. id, sequence number and both checksums are filled in per
+        // segment by inzunet_rx_patch_flow
+        iph->protocol = IPPROTO_TCP;
+        iph->frag_off = htons(IP_DF);
+        tcph = (struct tcphdr *)(iph + 1);
+        tcph->source = htons(INZUNET_RX_FLOW_PORT);
+        tcph->dest = htons(INZUNET_RX_PORT);
+        tcph->ack_seq = htonl(1);
+        tcph->doff = sizeof(*tcph) / 4;
+        tcph->ack = 1;
+        tcph->window = htons(U16_MAX);
+        ip_send_check(iph);
+        return len;
+    }
+
+    iph->protocol = IPPROTO_UDP;
+    ip_send_check(iph);
+
+    udph = (struct udphdr *)(iph + 1);
+    udph->source = htons(INZUNET_RX_FLOW_PORT);
+    udph->dest = htons(INZUNET_RX_PORT);
+    udph->len = htons(len - ETH_HLEN - sizeof(*iph));
+    udph->check = 0; // zero means "no checksum" for UDP over IPv4
+    return len;
+}
+
+// Toeplitz hash, what NICs use for RSS. For every set bit of the input XOR in the 32 bits of the key starting at that bit
+// position. Only runs when flows are set up in ndo_open, never per packet.
+static u32 inzunet_toeplitz(const u8 *key, const u8 *data, unsigned int len)
+{
+    u32 window = (u32)key[0] << 24 | (u32)key[1] << 16 | (u32)key[2] << 8 | key[3]; // key bits [i, i + 32) for input bit i
+    u32 hash = 0;
+    unsigned int i;
+    int b;
+
+    for (i = 0; i < len; i++) {
+        for (b = 7; b >= 0; b--) {
+            if (data[i] & BIT(b))
+                hash ^= window;
+            window = (window << 1) | ((key[i + 4] >> b) & 1);
+        }
+    }
+    return hash;
+}
+
+// hash of a synthetic flow's IPv4 4-tuple, laid out the way the RSS spec feeds it in: source address, destination address,
+// source port, destination port, all in network byte order
+static u32 inzunet_rss_hash(const struct inzunet_priv *priv, u16 sport)
+{
+    struct {
+        __be32 saddr;
+        __be32 daddr;
+        __be16 sport;
+        __be16 dport;
+    } __packed tuple = {
+        .saddr = htonl(INZUNET_RX_SADDR),
+        .daddr = htonl(INZUNET_RX_DADDR),
+        .sport = htons(sport),
+        .dport = htons(INZUNET_RX_PORT),
+    };
+
+    return inzunet_toeplitz(priv->rss_key, (const u8 *)&tuple, sizeof(tuple));
+}
+
+// Every queue generates its own traffic, so instead of hashing frames to queues we pick flows for each queue: walk the source
+// ports and give each flow to the queue the indirection table sends its hash to, until every queue has rx.flows of them.
+// The result is what a NIC would do with that same set of flows, and the table decides which queues (and so CPUs) are busy.
+// A queue the table never points at gets no flows and generates nothing.
+static int inzunet_rx_setup_flows(struct inzunet_priv *priv)
+{
+    unsigned int want = clamp_t(u32, priv->rx.flows, 1, INZUNET_RX_MAX_FLOWS);
+    unsigned int full = 0;
+    unsigned int i;
+    u32 port;
+
+    for (i = 0; i < priv->num_queues; i++) {
+        // the flow table is read on every generated frame, keep it next to the CPU that generates them
+        priv->queues[i]->rx_flows = kvzalloc_node(array_size(want, sizeof(struct inzunet_rx_flow)), GFP_KERNEL,
+                                                  cpu_to_node(priv->queues[i]->cpu));
+        if (!priv->queues[i]->rx_flows)
+            return -ENOMEM;
+        priv->queues[i]->rx_nflows = 0;
+    }
+
+    for (port = INZUNET_RX_FLOW_PORT; port <= U16_MAX && full < priv->num_queues; port++) {
+        u32 hash = inzunet_rss_hash(priv, port);
+        struct inzunet_queue *q = priv->queues[priv->rss_indir[hash & (INZUNET_RSS_INDIR_SIZE - 1)]];
+        struct inzunet_rx_flow *flow;
+
+        if (q->rx_nflows == want)
+            continue;
+        flow = &q->rx_flows[q->rx_nflows++];
+        flow->hash = hash;
+        flow->sport = port;
+        if (q->rx_nflows == want)
+            full++;
+    }
+    return 0;
+}
+
+// turns a fresh copy of the template into the next frame of the current flow. UDP frames only differ in the source port,
+// TCP segments also get the flow's next sequence number and IP id, so both checksums are redone. The payload is all zero
+// and adds nothing to the TCP checksum, so summing the 20 byte header is enough no matter how big the frame is.
+// Returns the flow's RSS hash.
+static u32 inzunet_rx_patch_flow(struct inzunet_queue *q, u8 *frame)
+{
+    struct inzunet_priv *priv = q->priv;
+    struct inzunet_rx_flow *flow = &q->rx_flows[q->rx_flow];
+    struct iphdr *iph = (struct iphdr *)(frame + ETH_HLEN);
+    __be16 sport = htons(flow->sport);
+    u32 hash = flow->hash;
+
+    if (iph->protocol == IPPROTO_TCP) {
+        struct tcphdr *tcph = (struct tcphdr *)(iph + 1);
+        unsigned int tcp_len = priv->rx_len - ETH_HLEN - sizeof(*iph);
+
+        iph->id = htons(flow->ip_id++);
+        ip_send_check(iph);
+        tcph->source = sport;
+        tcph->seq = htonl(flow->seq);
+        flow->seq += tcp_len - sizeof(*tcph);
+        tcph->check = csum_tcpudp_magic(iph->saddr, iph->daddr, tcp_len, IPPROTO_TCP,
+                                        csum_partial(tcph, sizeof(*tcph), 0));
+    } else {
+        ((struct udphdr *)(iph + 1))->source = sport; // checksum is 0 (none), nothing else to fix up
+    }
+
+    // move on to the next flow once this one had its burst
+    if (--q->rx_burst_left == 0) {
+        q->rx_burst_left = priv->rx_burst;
+        if (++q->rx_flow == q->rx_nflows)
+            q->rx_flow = 0;
+    }
+    return hash;
+}
+
+// how many frames this poll should generate
+static int inzunet_rx_owed(struct inzunet_queue *q, int budget)
+{
+    int pps = q->priv->rx.pps;
+    u64 now, due, owed;
+
+    // RSS gave this queue no flows, so it has nothing to send even when the peer, an XSK wakeup or a busy poller runs its NAPI
+    if (!pps || (q->priv->rx_per_flow && !q->rx_nflows))
+        return 0;
+    if (pps < 0)
+        return budget; // flat out, always the whole budget
+
+    now = ktime_get_ns();
+    due = mul_u64_u32_div(now - q->rx_start_ns, pps, NSEC_PER_SEC);
+    if (due <= q->rx_sent)
+        return 0;
+    owed = due - q->rx_sent;
+    // if we fell more than a millisecond (or a full poll) behind, say the softirq was starved, don't try to catch up in a burst
+    // that would look nothing like the configured rate, start pacing again from now
+    if (owed > max_t(u64, budget, pps / MSEC_PER_SEC)) {
+        q->rx_start_ns = now;
+        q->rx_sent = 0;
+        return budget;
+    }
+    return min_t(u64, owed, budget);
+}
+
+// GRO_MERGED and GRO_MERGED_FREE mean the skb was folded into one GRO is already holding, so the stack never sees it on its own
+static bool inzunet_gro_merged(gro_result_t ret)
+{
+    return ret == GRO_MERGED || ret == GRO_MERGED_FREE;
+}
+
+// gives a frame's buffer back where it came from, page is NULL for a zero-copy buffer which goes back to the XSK pool
+static void inzunet_rx_free_buff(struct inzunet_queue *q, struct xdp_buff *xdp, struct page *page)
+{
+    if (page)
+        page_pool_recycle_direct(q->page_pool, page);
+    else
+        xsk_buff_free(xdp);
+}
+
+// runs the XDP program on a frame sitting in a page_pool page (or an XSK buffer, page NULL). Returns true if the frame should
+// carry on to the stack, in which case xdp->data/data_end say where it now starts and ends (the program may have moved them).
+// On false the buffer is taken care of, recycled or handed to the redirect target.
+static bool inzunet_rx_run_xdp(struct inzunet_queue *q, struct bpf_prog *prog, struct xdp_buff *xdp,
+                               struct page *page, struct inzunet_rx_tally *tally)
+{
+    struct net_device *dev = q->priv->dev;
+    u32 act = bpf_prog_run_xdp(prog, xdp);
+
+    switch (act) {
+    case XDP_PASS:
+        tally->xdp_pass++;
+        return true;
+    case XDP_TX:
+        // bouncing it back out means sending it into the void on a sink device, count it and reuse the page
+        tally->xdp_tx++;
+        inzunet_rx_free_buff(q, xdp, page);
+        return false;
+    case XDP_REDIRECT:
+        // queues the frame for the redirect target (another device, a CPU map, an AF_XDP socket), flushed at the end of the poll.
+        // An XSK buffer redirected to the socket bound to this queue is handed over as is, that's the zero-copy part.
+        if (likely(!xdp_do_redirect(dev, xdp, prog))) {
+            tally->xdp_redirect++;
+            return false;
+        }
+        break;
+    default:
+        bpf_warn_invalid_xdp_action(dev, prog, act);
+        break;
+    case XDP_ABORTED:
+        break;
+    case XDP_DROP:
+        tally->xdp_drop++;
+        inzunet_rx_free_buff(q, xdp, page);
+        return false;
+    }
+    // aborted, unknown verdict or failed redirect all end up here
+    trace_xdp_exception(dev, prog, act);
+    tally->xdp_aborted++;
+    inzunet_rx_free_buff(q, xdp, page);
+    return false;
+}
+
+// napi_build_skb wraps an skb head around the page we already filled instead of allocating and copying, the head comes from
+// the per-CPU NAPI skb cache
+static struct sk_buff *inzunet_rx_build_skb(struct inzunet_queue *q, struct xdp_buff *xdp, struct page *page)
+{
+    struct sk_buff *skb = napi_build_skb(xdp->data_hard_start, PAGE_SIZE);
+
+    if (unlikely(!skb)) {
+        page_pool_recycle_direct(q->page_pool, page);
+        return NULL;
+    }
+    skb_reserve(skb, xdp->data - xdp->data_hard_start);
+    __skb_put(skb, xdp->data_end - xdp->data);
+    if (xdp->data_meta < xdp->data)
+        skb_metadata_set(skb, xdp->data - xdp->data_meta); // the program left metadata in front of the frame
+    skb_mark_for_recycle(skb); // when the stack frees this skb the page goes back to our pool instead of the page allocator
+    return skb;
+}
+
+// an XSK buffer is userspace's UMEM and can't become an skb, a frame XDP passes to the stack is copied out and the buffer goes
+// straight back to the pool, the same thing every zero-copy driver does on XDP_PASS
+static struct sk_buff *inzunet_rx_copy_xsk(struct inzunet_queue *q, struct xdp_buff *xdp)
+{
+    unsigned int len = xdp->data_end - xdp->data;
+    struct sk_buff *skb = napi_alloc_skb(&q->napi, len);
+
+    if (likely(skb))
+        skb_put_data(skb, xdp->data, len);
+    xsk_buff_free(xdp);
+    return skb;
+}
+
+// generates up to budget synthetic frames and hands them to XDP and then the stack, returns how many frames were generated
+static int inzunet_rx_inject(struct inzunet_queue *q, int budget, struct inzunet_rx_tally *tally)
+{
+    struct inzunet_priv *priv = q->priv;
+    struct net_device *dev = priv->dev;
+    unsigned int len = priv->rx_len;
+    int owed = inzunet_rx_owed(q, budget);
+    struct xsk_buff_pool *xsk = q->xsk_pool;
+    struct bpf_prog *prog;
+    bool lat = static_branch_unlikely(&inzunet_lat_key);
+    bool hwts = READ_ONCE(priv->hwts_rx);
+    u64 poll_ns = 0;
+    u32 hash = 0;
+    int done;
+
+    if (!owed)
+        return 0;
+    if (xsk && unlikely(len > xsk_pool_get_rx_frame_size(xsk))) {
+        // the socket's chunks are smaller than our frames, a NIC would drop these too
+        tally->dropped += owed;
+        q->rx_sent += owed;
+        return owed;
+    }
+    prog = rcu_dereference(priv->xdp_prog); // the poll runs inside rcu_read_lock, see inzunet_poll
+    if ((lat || hwts) && priv->rx.pps < 0)
+        poll_ns = ktime_get_ns(); // flat out frames have no schedule, they are due the moment the poll starts
+
+    for (done = 0; done < owed; done++) {
+        struct page *page = NULL;
+        struct sk_buff *skb;
+        struct xdp_buff pbuf, *xdp;
+        u8 *frame;
+
+        if (xsk) {
+            // zero-copy: the frame goes straight into a buffer the AF_XDP socket put on its fill queue, already set up
+            // for XDP with the pool's xsk_rxq
+            xdp = xsk_buff_alloc(xsk);
+            if (unlikely(!xdp)) {
+                tally->dropped += owed - done;
+                tally->xsk_fill_empty = true;
+                break;
+            }
+            xsk_buff_set_size(xdp, len);
+            frame = xdp->data;
+        } else {
+            // a recycled page from the pool, only falls back to the page allocator when the pool's cache is empty
+            page = page_pool_dev_alloc_pages(q->page_pool);
+            if (unlikely(!page)) {
+                tally->dropped += owed - done;
+                break;
+            }
+            // describe the frame to XDP: the whole page is the buffer, the frame starts after the headroom
+            xdp = &pbuf;
+            xdp_init_buff(xdp, PAGE_SIZE, &q->xdp_rxq);
+            xdp_prepare_buff(xdp, page_address(page), INZUNET_RX_HEADROOM, len, true);
+            frame = xdp->data;
+        }
+        memcpy(frame, priv->rx_template, len); // "DMA" the frame in, like a NIC writing into its RX ring
+        if (priv->rx_per_flow)
+            hash = inzunet_rx_patch_flow(q, frame);
+
+        if (prog && !inzunet_rx_run_xdp(q, prog, xdp, page, tally))
+            continue;
+
+        skb = xsk ? inzunet_rx_copy_xsk(q, xdp) : inzunet_rx_build_skb(q, xdp, page);
+        if (unlikely(!skb)) {
+            tally->dropped++;
+            continue;
+        }
+        tally->packets++;
+        tally->bytes += skb->len;
+        if (static_branch_unlikely(&inzunet_cap_key))
+            inzunet_cap(skb, dev, q->index, INZUNET_CAP_RX);
+        skb->protocol = eth_type_trans(skb, dev); // sets pkt_type and pulls the Ethernet header like every NIC driver does
+        // like a NIC that verified the checksums in hardware, our IPv4 frames are always correct so the stack may skip checking
+        if (priv->rx_per_flow) {
+            skb->ip_summed = CHECKSUM_UNNECESSARY;
+            // the hash a NIC computed for RSS, RPS/RFS and the socket layer reuse it instead of hashing the flow again
+            skb_set_hash(skb, hash, PKT_HASH_TYPE_L4);
+        }
+        skb_record_rx_queue(skb, q->index);
+        trace_inzunet_rx(dev, skb, q->index);
+        // a paced frame was due at rx_start_ns + n / pps, when a NIC would have received it. The latency histogram measures
+        // how late the timer, the softirq and everything ahead of it in this poll got it to the stack, and the "hardware" RX
+        // timestamp is that arrival time on the realtime clock, like a NIC stamping the frame as it comes off the wire
+        if (lat || hwts) {
+            u64 due = poll_ns ? poll_ns : q->rx_start_ns + mul_u64_u32_div(q->rx_sent + done, NSEC_PER_SEC, priv->rx.pps);
+
+            if (lat)
+                inzunet_rx_lat(tally, due);
+            if (hwts)
+                skb_hwtstamps(skb)->hwtstamp = ktime_mono_to_real(ns_to_ktime(due));
+        }
+        // hand it up, GRO may hold it to merge with the next one from the same flow
+        if (inzunet_gro_merged(napi_gro_receive(&q->napi, skb)))
+            tally->gro_merged++;
+    }
+    q->rx_sent += owed; // frames we failed to allocate are counted as dropped, not retried
+    return done;
+}
+
+// pair mode: after draining, complete what we took for the peer's BQL and restart its TX queue if it stopped because our
+// ring was full
+static void inzunet_rx_ring_wake(struct inzunet_queue *q, struct inzunet_rx_tally *tally, unsigned int pkts, unsigned int bytes)
+{
+    struct inzunet_ring *r = &q->ring;
+    struct net_device *peer;
+    struct netdev_queue *txq;
+
+    peer = rcu_dereference(q->priv->peer); // the poll runs inside rcu_read_lock
+    if (peer) {
+        txq = netdev_get_tx_queue(peer, q->index);
+        // a freed TX ring slot on a NIC is a taken ring slot here. This NAPI is the ring's only consumer, so the only
+        // completer of that queue, which is the serialization dql needs. Wakes the queue if BQL stopped it.
+        netdev_tx_completed_queue(txq, pkts, bytes);
+        // our tail store is visible before we read the queue state, pairs with the smp_mb in inzunet_xmit_peer
+        smp_mb();
+        if (unlikely(netif_tx_queue_stopped(txq)) && r->mask + 1 - inzunet_ring_count(r) >= inzunet_ring_wake_thresh(r)) {
+            netif_tx_wake_queue(txq); // also reschedules the peer's qdisc so the packets it held while stopped go out
+            tally->ring_wakeups++;
+        }
+    }
+}
+
+// pair mode, delivers up to budget skbs the peer transmitted to us. These are already skbs, so native XDP doesn't see them,
+// only the synthetic frames from the injector go through the XDP program.
+static int inzunet_rx_ring(struct inzunet_queue *q, int budget, struct inzunet_rx_tally *tally)
+{
+    struct inzunet_ring *r = &q->ring;
+    struct net_device *dev = q->priv->dev;
+    unsigned int n = min_t(unsigned int, inzunet_ring_ready(r), budget);
+    bool hwts;
+    ktime_t now = 0;
+    unsigned int i, bql_bytes = 0;
+
+    if (!n)
+        return 0;
+    // the peer's skbs "arrived" when it put them in the ring if latency recording noted that, otherwise stamp them with now
+    hwts = READ_ONCE(q->priv->hwts_rx);
+    if (hwts)
+        now = ktime_get_real();
+    for (i = 0; i < n; i++) {
+        struct sk_buff *skb = r->slots[(r->tail + i) & r->mask];
+
+        // the peer's xmit already scrubbed the skb and ran eth_type_trans for us (see inzunet_xmit_peer)
+        u64 bytes;
+
+        bql_bytes += INZUNET_SKB_CB(skb)->bql_len; // before GRO reuses cb
+        if (static_branch_unlikely(&inzunet_cap_key)) {
+            // eth_type_trans already pulled the Ethernet header, it's still right in front of data
+            __skb_push(skb, ETH_HLEN);
+            inzunet_cap(skb, dev, q->index, INZUNET_CAP_RX);
+            __skb_pull(skb, ETH_HLEN);
+        }
+        skb_record_rx_queue(skb, q->index);
+        trace_inzunet_rx(dev, skb, q->index);
+        // count the whole frame like a NIC, eth_type_trans already pulled the header
+        tally->packets += inzunet_skb_wire(skb, skb->len + ETH_HLEN, &bytes);
+        if (static_branch_unlikely(&inzunet_lat_key) && INZUNET_SKB_CB(skb)->enq_ns)
+            inzunet_rx_lat(tally, INZUNET_SKB_CB(skb)->enq_ns); // before GRO reuses cb
+        if (hwts)
+            skb_hwtstamps(skb)->hwtstamp = INZUNET_SKB_CB(skb)->enq_ns ?
+                                           ktime_mono_to_real(ns_to_ktime(INZUNET_SKB_CB(skb)->enq_ns)) : now;
+        tally->bytes += bytes;
+        if (inzunet_gro_merged(napi_gro_receive(&q->napi, skb)))
+            tally->gro_merged++;
+    }
+    inzunet_ring_consume_done(r, n);
+    inzunet_rx_ring_wake(q, tally, n, bql_bytes);
+    return n;
+}
+
+// ndo_stop, after napi_disable: what the peer left in our ring will never be received, free it like a NIC flushing its RX
+// ring on down. The skbs are still in flight in the peer's BQL, and may have filled the ring (or BQL's limit) enough to stop
+// the peer's queue. Only our NAPI would ever have completed them or woken it, so do both here or the peer stays stopped for
+// good. Its own ndo_stop never resets BQL in pair mode, exactly because these completions come from us. The peer can still
+// be producing (its xmit only starts dropping once our IFF_UP goes, after ndo_stop), whatever lands after this is picked up
+// when we come back up, see inzunet_rx_kick_ring.
+static void inzunet_rx_ring_flush(struct inzunet_queue *q)
+{
+    struct net_device *peer = rtnl_dereference(q->priv->peer);
+    struct inzunet_ring *r = &q->ring;
+    unsigned int n = inzunet_ring_ready(r);
+    struct inzunet_pcpu_stats *stats;
+    unsigned int i, bql_bytes = 0;
+
+    if (!n)
+        return;
+    for (i = 0; i < n; i++) {
+        struct sk_buff *skb = r->slots[(r->tail + i) & r->mask];
+
+        bql_bytes += INZUNET_SKB_CB(skb)->bql_len;
+        kfree_skb(skb);
+    }
+    inzunet_ring_consume_done(r, n);
+
+    if (peer) {
+        struct netdev_queue *txq = netdev_get_tx_queue(peer, q->index);
+
+        // serialized with our NAPI's completions since it's disabled, clears a BQL stop (STACK_XOFF) like the poll would
+        netdev_tx_completed_queue(txq, n, bql_bytes);
+        if (netif_running(peer))
+            netif_tx_wake_queue(txq); // a peer that is down starts its queues in its own open
+    }
+
+    local_bh_disable(); // the per-CPU stats are written from softirq everywhere else
+    stats = this_cpu_ptr(q->stats);
+    u64_stats_update_begin(&stats->syncp);
+    u64_stats_add(&stats->rx_dropped, n);
+    u64_stats_update_end(&stats->syncp);
+    local_bh_enable();
+}
+
+// ndo_open and inzunet_queue_resume: the NAPI only runs on its own for the injector, a ring the peer filled while we were down
+// (or quiesced) needs a kick or with rx_pps=0 nothing drains it. Only reads the indexes, the NAPI is already enabled and may be
+// consuming (and updating cached_head) on another CPU. Whatever the peer produces after this schedules us itself.
+static void inzunet_rx_kick_ring(struct inzunet_queue *q)
+{
+    if (smp_load_acquire(&q->ring.head) == READ_ONCE(q->ring.tail))
+        return;
+    local_bh_disable(); // so the NAPI softirq runs as soon as we re-enable
+    napi_schedule(&q->napi);
+    local_bh_enable();
+}
+
+// AF_XDP zero-copy TX: takes up to budget descriptors off the socket's TX ring and completes them all at once. A NIC would
+// have to DMA the data out first, for us sent and done are the same moment, so there is no completion interrupt to wait for
+// and userspace gets the whole batch back on its completion ring in one go. Returns how many descriptors we took.
+static unsigned int inzunet_xsk_tx(struct xsk_buff_pool *pool, unsigned int budget, struct inzunet_rx_tally *tally)
+{
+    struct xdp_desc *descs = pool->tx_descs;
+    unsigned int n = xsk_tx_peek_release_desc_batch(pool, budget);
+    unsigned int i;
+
+    for (i = 0; i < n; i++)
+        tally->xsk_tx_bytes += descs[i].len;
+    if (n)
+        xsk_tx_completed(pool, n);
+    tally->xsk_tx_packets += n;
+    // with need_wakeup userspace only kicks us (sendto -> ndo_xsk_wakeup) when the flag is set, set it once we've run dry
+    if (xsk_uses_need_wakeup(pool)) {
+        if (n < budget)
+            xsk_set_tx_need_wakeup(pool);
+        else
+            xsk_clear_tx_need_wakeup(pool);
+    }
+    return n;
+}
+
+// NAPI poll function, called by the core in softirq context after napi_schedule
+static int inzunet_poll(struct napi_struct *napi, int budget)
+{
+    struct inzunet_queue *q = container_of(napi, struct inzunet_queue, napi);
+    struct xsk_buff_pool *xsk = q->xsk_pool;
+    struct inzunet_rx_tally tally = {};
+    struct inzunet_pcpu_stats *stats;
+    bool tx_busy = false;
+    int done;
+
+    rcu_read_lock(); // protects the XDP program and the peer pointer
+    if (xsk)
+        tx_busy = inzunet_xsk_tx(xsk, budget, &tally) == budget; // TX has its own budget, like NIC drivers cleaning TX in poll
+    done = inzunet_rx_ring(q, budget, &tally); // the peer's real traffic goes first
+    done += inzunet_rx_inject(q, budget - done, &tally);
+    if (tally.xdp_redirect)
+        xdp_do_flush(); // actually pushes the frames XDP_REDIRECT queued out to their targets
+    rcu_read_unlock();
+    // an empty fill queue stops RX until userspace refills it, with need_wakeup it has to tell us it did
+    if (xsk && xsk_uses_need_wakeup(xsk)) {
+        if (tally.xsk_fill_empty)
+            xsk_set_rx_need_wakeup(xsk);
+        else
+            xsk_clear_rx_need_wakeup(xsk);
+    }
+
+    // one counter update per poll, and outside the loops so the stack (which may xmit on this CPU) never runs inside a write section
+    stats = this_cpu_ptr(q->stats);
+    u64_stats_update_begin(&stats->syncp);
+    u64_stats_add(&stats->rx_packets, tally.packets);
+    u64_stats_add(&stats->rx_bytes, tally.bytes);
+    u64_stats_add(&stats->rx_dropped, tally.dropped);
+    u64_stats_add(&stats->rx_ring_wakeups, tally.ring_wakeups);
+    u64_stats_add(&stats->rx_gro_merged, tally.gro_merged);
+    u64_stats_add(&stats->xdp_pass, tally.xdp_pass);
+    u64_stats_add(&stats->xdp_drop, tally.xdp_drop);
+    u64_stats_add(&stats->xdp_tx, tally.xdp_tx);
+    u64_stats_add(&stats->xdp_redirect, tally.xdp_redirect);
+    u64_stats_add(&stats->xdp_aborted, tally.xdp_aborted);
+    u64_stats_add(&stats->xsk_tx_packets, tally.xsk_tx_packets);
+    u64_stats_add(&stats->xsk_tx_bytes, tally.xsk_tx_bytes);
+    u64_stats_update_end(&stats->syncp);
+    if (tally.lat_count)
+        inzunet_lat_flush(q->priv, tally.lat, false);
+
+    // flat out mode always claims the whole budget so the core keeps polling us (and moves us to ksoftirqd if we hog the CPU),
+    // and so does an XSK TX ring we didn't manage to empty. Not a queue RSS gave no flows, it injects nothing, so whatever
+    // scheduled it (the peer, an XSK wakeup, a busy poller) gets a normal poll that completes instead of one that spins.
+    // Nor an XSK fill queue that ran dry, need_wakeup is set above so we park until userspace refills it and wakes us.
+    if ((q->priv->rx.pps < 0 && (!q->priv->rx_per_flow || q->rx_nflows) && !tally.xsk_fill_empty) || tx_busy)
+        return budget;
+    // using less than the budget means we're caught up, napi_complete_done takes us off the poll list until something schedules us again
+    if (done < budget && napi_complete_done(napi, done)) {
+        // the peer may have added to the ring after we saw it empty but before we completed, its napi_schedule would have
+        // failed since we were still scheduled, so look once more. Pairs with the smp_mb in inzunet_tx_flush.
+        smp_mb();
+        if (unlikely(inzunet_ring_ready(&q->ring)))
+            napi_schedule(napi);
+    }
+    return done;
+}
+
+// pacing timer, runs in softirq context (HRTIMER_MODE_SOFT) on the queue's CPU
+static enum hrtimer_restart inzunet_rx_timer(struct hrtimer *timer)
+{
+    struct inzunet_queue *q = container_of(timer, struct inzunet_queue, rx_timer);
+
+    napi_schedule(&q->napi); // does nothing if the poll is already scheduled or running
+    hrtimer_forward_now(timer, ns_to_ktime(q->priv->rx_tick_ns));
+    return HRTIMER_RESTART;
+}
+
+// hrtimer_init was replaced by hrtimer_setup in 6.13
+static void inzunet_hrtimer_init(struct hrtimer *timer, enum hrtimer_restart (*fn)(struct hrtimer *), enum hrtimer_mode mode)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+    hrtimer_setup(timer, fn, CLOCK_MONOTONIC, mode);
+#else
+    hrtimer_init(timer, CLOCK_MONOTONIC, mode);
+    timer->function = fn;
+#endif
+}
+
+// --- link emulation ---
+
+// the wire caught up with what xmit accepted, restart the queue. Like a NIC's TX completion interrupt, the qdisc gets
+// rescheduled by the wake and sends the next burst.
+static enum hrtimer_restart inzunet_link_timer(struct hrtimer *timer)
+{
+    struct inzunet_queue *q = container_of(timer, struct inzunet_queue, link_timer);
+    struct inzunet_pcpu_stats *stats = this_cpu_ptr(q->stats);
+
+    u64_stats_update_begin(&stats->syncp);
+    u64_stats_add(&stats->tx_link_stopped_ns, ktime_get_ns() - q->link_stop_ns);
+    u64_stats_update_end(&stats->syncp);
+    netif_tx_wake_queue(netdev_get_tx_queue(q->priv->dev, q->index)); // outside the write section, it may run the qdisc
+    return HRTIMER_NORESTART;
+}
+
+// The emulated TX completion interrupt: frees the skbs that are due, tells BQL they completed and rearms for the next one.
+// Freeing runs their destructors, which is when TCP's small queue accounting gives the socket its budget back, so the delay
+// shows up where a long wire would. Like a NIC with interrupt moderation it fires at most every INZUNET_LINK_COALESCE_NS
+// and completes everything due by then in one go, otherwise a 10G link of small frames would be a timer per packet.
+static enum hrtimer_restart inzunet_delay_timer(struct hrtimer *timer)
+{
+    struct inzunet_queue *q = container_of(timer, struct inzunet_queue, delay_timer);
+    struct sk_buff_head done;
+    struct sk_buff *skb;
+    u64 now = ktime_get_ns(), next = 0;
+    unsigned int pkts = 0, bytes = 0;
+
+    __skb_queue_head_init(&done);
+    spin_lock(&q->link_delayed.lock); // xmit takes it with BH disabled, we're in softirq, nobody takes it from hardirq
+    while ((skb = skb_peek(&q->link_delayed))) {
+        if (INZUNET_SKB_CB(skb)->due_ns > now) {
+            next = INZUNET_SKB_CB(skb)->due_ns;
+            break;
+        }
+        __skb_unlink(skb, &q->link_delayed);
+        __skb_queue_tail(&done, skb);
+    }
+    spin_unlock(&q->link_delayed.lock);
+
+    while ((skb = __skb_dequeue(&done))) {
+        pkts++;
+        bytes += INZUNET_SKB_CB(skb)->bql_len;
+        consume_skb(skb);
+    }
+    // this timer is the only completer for the queue, which is the serialization dql needs. Wakes the queue if BQL stopped it.
+    if (pkts)
+        netdev_tx_completed_queue(netdev_get_tx_queue(q->priv->dev, q->index), pkts, bytes);
+    if (!next)
+        return HRTIMER_NORESTART; // xmit rearms when it finds the list empty, under the same lock we just saw it empty with
+    hrtimer_set_expires(timer, ns_to_ktime(max(next, now + INZUNET_LINK_COALESCE_NS)));
+    return HRTIMER_RESTART;
+}
+
+// Charges the skb's time on the wire to the queue. The queue may run up to INZUNET_LINK_AHEAD_NS ahead of real time, that's
+// the bucket depth, a NIC's TX ring worth of burst. Past that the queue stops until link_timer sees the wire caught up halfway,
+// so the qdisc fills up and does its job exactly like in front of a real NIC. Idle time earns no credit beyond the bucket,
+// start is never earlier than now. Runs under the TX queue lock (link emulation is never on for lltx devices).
+// Every skb then stays on link_delayed until its last bit has left (plus link_delay_ns), that's when it completes for BQL.
+// Returns true if it kept the skb, false if the caller frees it now.
+static bool inzunet_link_xmit(struct inzunet_priv *priv, struct inzunet_queue *q, struct netdev_queue *txq,
+                              struct sk_buff *skb, struct inzunet_tx_batch *batch)
+{
+    u64 now = ktime_get_ns();
+    u64 due = now;
+    bool empty;
+
+    if (priv->link_mbps) {
+        u64 bytes;
+        unsigned int segs = __inzunet_skb_wire(skb, skb->len, &bytes);
+
+        bytes += (u64)segs * INZUNET_LINK_OVERHEAD;
+        // bits * 1000 / Mbit/s = ns, math64 so 32 bit kernels don't need a 64 bit division
+        q->link_next_ns = max(q->link_next_ns, now) + mul_u64_u32_div(bytes, 8 * 1000, priv->link_mbps);
+        due = q->link_next_ns; // the last bit leaves then
+        if (q->link_next_ns - now > INZUNET_LINK_AHEAD_NS) {
+            netif_tx_stop_queue(txq);
+            q->link_stop_ns = now;
+            batch->link_stops++;
+            hrtimer_start(&q->link_timer, ns_to_ktime(q->link_next_ns - INZUNET_LINK_AHEAD_NS / 2), HRTIMER_MODE_ABS_SOFT);
+        }
+    }
+    // a delay with no rate limit (or a BQL limit someone raised a lot) could otherwise pile up without bound, past the cap
+    // skbs skip the delay line and BQL, which only counts what a completion will give back
+    if (unlikely(skb_queue_len(&q->link_delayed) >= INZUNET_LINK_DELAY_MAX))
+        return false;
+
+    INZUNET_SKB_CB(skb)->due_ns = due + priv->link_delay_ns;
+    INZUNET_SKB_CB(skb)->bql_len = skb->len;
+    // before the skb is on the list, the delay timer may complete it on another CPU the moment it is. May stop the queue.
+    netdev_tx_sent_queue(txq, skb->len);
+    spin_lock(&q->link_delayed.lock);
+    empty = skb_queue_empty(&q->link_delayed);
+    __skb_queue_tail(&q->link_delayed, skb);
+    spin_unlock(&q->link_delayed.lock);
+    if (empty)
+        hrtimer_start(&q->delay_timer, ns_to_ktime(due + priv->link_delay_ns), HRTIMER_MODE_ABS_SOFT);
+    return true;
+}
+
+// runs on the queue's CPU (from an IPI, so think of it as the fake NIC interrupt). A NAPI instance is polled on the CPU that
+// scheduled it, and a pinned hrtimer fires on the CPU that started it, so doing both here keeps the whole queue on q->cpu.
+static void inzunet_rx_kick(void *arg)
+{
+    struct inzunet_queue *q = arg;
+
+    if (q->priv->rx.pps > 0)
+        hrtimer_start(&q->rx_timer, ns_to_ktime(q->priv->rx_tick_ns), HRTIMER_MODE_REL_PINNED_SOFT);
+    else
+        napi_schedule(&q->napi);
+}
+
+static void inzunet_rx_start(struct inzunet_queue *q)
+{
+    if (!q->priv->rx.pps)
+        return;
+    q->rx_start_ns = ktime_get_ns();
+    q->rx_sent = 0;
+    if (smp_call_function_single(q->cpu, inzunet_rx_kick, q, 1)) {
+        // the queue's CPU went offline, run the queue here instead. BH disabled so the NAPI softirq runs as soon as we re-enable
+        local_bh_disable();
+        inzunet_rx_kick(q);
+        local_bh_enable();
+    }
+}
+
+// free the per-queue state, safe to call on a partially set up array since inzunet_ring_cleanup on a zeroed ring and
+// free_percpu(NULL) are no-ops. Every queue is allocated and has its NAPI registered before anything else can fail, so there
+// are no holes to skip.
+// The queue structs and their page pools outlive this, see inzunet_free_queue_mem. netif_napi_del waits out an RCU grace period for
+// every NAPI it removes, which unregistering a few hundred multiqueue devices turns into seconds. __netif_napi_del doesn't
+// wait, unregister_netdevice_many waits once for the whole batch after ndo_uninit, and only then may the NAPIs be freed
+// (a busy poller can still be looking one up by napi_id under rcu_read_lock until then).
+static void inzunet_free_queues(struct inzunet_priv *priv)
+{
+    unsigned int i;
+
+    if (!priv->queues)
+        return;
+    for (i = 0; i < priv->num_queues; i++) {
+        struct inzunet_queue *q = priv->queues[i];
+
+        // the XSK socket unbinds on NETDEV_UNREGISTER before we get here, this only catches a half finished setup
+        if (xdp_rxq_info_is_reg(&q->xsk_rxq))
+            xdp_rxq_info_unreg(&q->xsk_rxq);
+        // the XDP memory model holds a reference to the pool, dropping it is cheap as long as ours is still there
+        if (xdp_rxq_info_is_reg(&q->xdp_rxq))
+            xdp_rxq_info_unreg(&q->xdp_rxq);
+        __netif_napi_del(&q->napi); // leaves the NAPI disabled, which is all the pool checks for when it's destroyed later
+        inzunet_ring_cleanup(&q->ring);
+        free_percpu(q->stats);
+        q->stats = NULL;
+    }
+}
+
+// dropping the last reference to a page pool waits out an RCU grace period on recent kernels, per pool, so it happens here
+// rather than on the unregister path with rtnl held. The pool is linked to the NAPI inside the queue, so the queue goes with it.
+static void inzunet_queue_free_work(struct work_struct *work)
+{
+    struct inzunet_queue *q = container_of(work, struct inzunet_queue, free_work);
+
+    page_pool_destroy(q->page_pool); // pages still in flight keep it around until they come back, the core handles that
+    kfree(q);
+}
+
+// the second half of inzunet_free_queues, once nobody can reach the NAPIs inside the queues any more. Runs as
+// dev->priv_destructor, which the core calls after the grace period that follows ndo_uninit, or right after ndo_uninit when
+// register_netdevice fails. Queues with a pool are handed to inzunet_wq, one work item each: the unbound workqueue runs them
+// side by side, so deleting a few hundred devices overlaps their grace periods instead of waiting for them one after another.
+static void inzunet_free_queue_mem(struct net_device *dev)
+{
+    struct inzunet_priv *priv = netdev_priv(dev);
+    unsigned int i;
+
+    if (!priv->queues)
+        return;
+    for (i = 0; i < priv->num_queues; i++) {
+        struct inzunet_queue *q = priv->queues[i];
+
+        if (q->page_pool) {
+            INIT_WORK(&q->free_work, inzunet_queue_free_work);
+            queue_work(inzunet_wq, &q->free_work);
+        } else {
+            kfree(q);
+        }
+    }
+    kfree(priv->queues);
+    priv->queues = NULL;
+}
+
+// one page_pool per RX queue. The pool keeps pages the stack has finished with in a per-pool cache and hands them straight back to
+// the next poll, so in steady state receiving a frame never touches the page allocator. Setting .napi allows the lockless
+// "direct" recycle path when the skb is freed from this same NAPI context.
+// Built on the queue's first ndo_open rather than in ndo_init, and kept until the device goes away. A device that is created
+// and deleted without ever coming up (CI churning through hundreds) then never pays for a pool, its ring of cached pages,
+// or the XDP memory model registration.
+// Kept over down/up since /proc reads q->page_pool without rtnl, freeing it in ndo_stop would pull it out from under a reader.
+static int inzunet_rx_create_pool(struct inzunet_queue *q)
+{
+    struct page_pool_params pp = {
+        .order = 0, // one page per frame, rx_size is clamped to fit
+        .pool_size = INZUNET_RX_POOL_SIZE,
+        .nid = cpu_to_node(q->cpu), // pages come from the memory closest to the CPU that fills them
+        .napi = &q->napi,
+        .netdev = q->priv->dev, // shows the pool in "ynl --family netdev --dump page-pool-get"
+        // no PP_FLAG_DMA_MAP, there is no hardware to map for
+    };
+    struct page_pool *pool;
+    int err;
+
+    if (q->page_pool)
+        return 0; // built by an earlier open
+    pool = page_pool_create(&pp);
+    if (IS_ERR(pool))
+        return PTR_ERR(pool);
+    // also registered here since the memory model needs the pool, no XDP program runs before ndo_open anyway
+    err = xdp_rxq_info_reg(&q->xdp_rxq, q->priv->dev, q->index, q->napi.napi_id);
+    if (err)
+        goto err_pool;
+    // frames XDP_REDIRECT sends elsewhere are returned to this pool once the target is done with them
+    err = xdp_rxq_info_reg_mem_model(&q->xdp_rxq, MEM_TYPE_PAGE_POOL, pool);
+    if (err)
+        goto err_rxq;
+    WRITE_ONCE(q->page_pool, pool); // last, /proc only ever sees NULL or a finished pool
+    return 0;
+
+err_rxq:
+    xdp_rxq_info_unreg(&q->xdp_rxq);
+err_pool:
+    page_pool_destroy(pool);
+    return err;
+}
+
+// ndo_init is called by register_netdev before the device becomes visible, good place to allocate things the device needs while registered
+static int inzunet_dev_init(struct net_device *dev)
+{
+    struct inzunet_priv *priv = netdev_priv(dev);
+    unsigned int i;
+    int err;
+
+    priv->dev = dev;
+    priv->tx_batch = alloc_percpu(struct inzunet_tx_batch);
+    if (!priv->tx_batch)
+        return -ENOMEM;
+    priv->lat = netdev_alloc_pcpu_stats(struct inzunet_pcpu_lat);
+    if (!priv->lat) {
+        free_percpu(priv->tx_batch);
+        return -ENOMEM;
+    }
+
+    priv->num_queues = dev->real_num_tx_queues; // fewer than were allocated if IFLA_INZUNET_QUEUES asked for it
+    priv->queues = kcalloc(priv->num_queues, sizeof(*priv->queues), GFP_KERNEL);
+    if (!priv->queues) {
+        free_percpu(priv->lat);
+        free_percpu(priv->tx_batch);
+        return -ENOMEM;
+    }
+
+    // a queue is written by the CPU its NAPI runs on and by whoever transmits into it, and read by nobody else in the hot path. One
+    // allocation per queue on that CPU's node keeps its cache lines in local memory, where one array would put every queue on
+    // whichever node ran ndo_init. kmalloc of a struct this size is at least cache line aligned, as the struct asks.
+    for (i = 0; i < priv->num_queues; i++) {
+        // spread queues over online CPUs, queue i runs on the i-th one, unless queue_cpu says otherwise
+        unsigned int cpu = cpumask_local_spread(i, NUMA_NO_NODE);
+        struct inzunet_queue *q;
+
+        if (i < queue_cpu_count && queue_cpu[i] >= 0 && queue_cpu[i] < nr_cpu_ids && cpu_online(queue_cpu[i]))
+            cpu = queue_cpu[i];
+        q = kzalloc_node(sizeof(*q), GFP_KERNEL, cpu_to_node(cpu));
+        if (!q) {
+            while (i--)
+                kfree(priv->queues[i]);
+            kfree(priv->queues);
+            priv->queues = NULL;
+            free_percpu(priv->lat);
+            free_percpu(priv->tx_batch);
+            return -ENOMEM;
+        }
+        q->cpu = cpu;
+        priv->queues[i] = q;
+    }
+
+    // nothing in this loop can fail, so every queue has its NAPI registered before the allocations below that might
+    for (i = 0; i < priv->num_queues; i++) {
+        struct inzunet_queue *q = priv->queues[i];
+
+        q->priv = priv;
+        q->index = i;
+        inzunet_hrtimer_init(&q->rx_timer, inzunet_rx_timer, HRTIMER_MODE_REL_SOFT);
+        inzunet_hrtimer_init(&q->link_timer, inzunet_link_timer, HRTIMER_MODE_ABS_SOFT);
+        inzunet_hrtimer_init(&q->delay_timer, inzunet_delay_timer, HRTIMER_MODE_ABS_SOFT);
+        skb_queue_head_init(&q->link_delayed);
+        // registers the poll function, the NAPI starts disabled. Since 6.13 napi_enable hands out the NAPI ID, the _config
+        // variant keeps the ID (and per-NAPI settings like threaded and defer-hard-irqs) of queue i the same across down/up,
+        // so a busy polling app or a pinned NAPI thread survives a restart
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+        netif_napi_add_config(dev, &q->napi, inzunet_poll, i);
+#else
+        netif_napi_add(dev, &q->napi, inzunet_poll);
+#endif
+    }
+
+    for (i = 0; i < priv->num_queues; i++) {
+        struct inzunet_queue *q = priv->queues[i];
+
+        // netdev_alloc_pcpu_stats allocates one zeroed copy per possible CPU and initializes each syncp for us. The percpu allocator
+        // already places each CPU's copy on that CPU's node, so the stats need no node of their own.
+        q->stats = netdev_alloc_pcpu_stats(struct inzunet_pcpu_stats);
+        if (!q->stats) {
+            err = -ENOMEM;
+            goto err_free;
+        }
+        // the ring stays in ndo_init, unlike the pool: the peer's xmit checks it for space before it learns we're down
+        err = inzunet_ring_init(&q->ring, roundup_pow_of_two(clamp(ring_size, 2U, (unsigned int)INZUNET_RING_MAX)),
+                                cpu_to_node(q->cpu));
+        if (err)
+            goto err_free;
+    }
+
+    // a random key like NICs get, and a table that deals hash buckets out to the queues round robin
+    netdev_rss_key_fill(priv->rss_key, sizeof(priv->rss_key));
+    for (i = 0; i < INZUNET_RSS_INDIR_SIZE; i++)
+        priv->rss_indir[i] = ethtool_rxfh_indir_default(i, priv->num_queues);
+    return 0;
+
+err_free:
+    inzunet_free_queues(priv);
+    synchronize_net(); // the NAPIs could be looked up by ID since netif_napi_add, a failed ndo_init is rare enough to wait here
+    inzunet_free_queue_mem(dev);
+    free_percpu(priv->lat);
+    free_percpu(priv->tx_batch);
+    return err;
+}
+
+// ndo_uninit is the mirror of ndo_init, called by unregister_netdev (or by register_netdev if registration fails after ndo_init)
+static void inzunet_dev_uninit(struct net_device *dev)
+{
+    struct inzunet_priv *priv = netdev_priv(dev);
+    struct net_device *peer = rtnl_dereference(priv->peer);
+
+    // pairs are always unregistered together (see inzunet_destroy_all), by now both ends are closed and the core has waited out every
+    // xmit that could still be feeding our rings, so unlinking them here is all that is left
+    if (peer) {
+        struct inzunet_priv *peer_priv = netdev_priv(peer);
+
+        RCU_INIT_POINTER(peer_priv->peer, NULL);
+        RCU_INIT_POINTER(priv->peer, NULL);
+    }
+
+    list_del_init(&priv->list); // fine if it never made it onto the list, setup initialized it
+
+    // the device is already closed here, so the timers are stopped and the NAPIs disabled
+    inzunet_free_queues(priv);
+    // every burst ends with a flush (the last skb of a burst never has xmit_more set), so no skb can be left in here
+    free_percpu(priv->tx_batch);
+    priv->tx_batch = NULL;
+    free_percpu(priv->lat);
+    priv->lat = NULL;
+    kfree(priv->gen); // threads were stopped in ndo_stop, only the results are left
+    priv->gen = NULL;
+}
+
+// maps the CPU we are running on to a TX queue. With the default numqueues every CPU gets its own queue, with fewer queues
+// than CPUs they wrap around so CPU n and CPU n + numqueues share one.
+static u16 inzunet_cpu_to_queue(const struct net_device *dev, unsigned int cpu)
+{
+    return cpu % dev->real_num_tx_queues;
+}
+
+// XPS (transmit packet steering) tells the core which CPUs should use which TX queue, we program it with the same mapping
+// inzunet_cpu_to_queue uses so /sys/class/net/<dev>/queues/tx-N/xps_cpus shows what really happens
+static void inzunet_set_xps(struct net_device *dev)
+{
+    cpumask_var_t mask;
+    unsigned int cpu;
+    u16 qid;
+
+    if (!zalloc_cpumask_var(&mask, GFP_KERNEL))
+        return; // XPS is only a hint, we still steer in ndo_select_queue without it
+
+    for (qid = 0; qid < dev->real_num_tx_queues; qid++) {
+        cpumask_clear(mask);
+        for_each_possible_cpu(cpu)
+            if (inzunet_cpu_to_queue(dev, cpu) == qid)
+                cpumask_set_cpu(cpu, mask);
+        netif_set_xps_queue(dev, mask, qid);
+    }
+    free_cpumask_var(mask);
+}
+
+// --- TX generator ---
+
+// one ready to send IPv4/UDP frame, the mirror image of what the RX injector generates. In pair mode it's addressed to the
+// peer so the other end takes it as PACKET_HOST, otherwise to ourselves.
+static struct sk_buff *inzunet_gen_build_skb(struct net_device *dev, unsigned int len)
+{
+    struct inzunet_priv *priv = netdev_priv(dev);
+    struct net_device *peer;
+    struct sk_buff *skb;
+    struct ethhdr *eth;
+    struct iphdr *iph;
+    struct udphdr *udph;
+
+    skb = alloc_skb(LL_RESERVED_SPACE(dev) + len, GFP_KERNEL);
+    if (!skb)
+        return NULL;
+    skb_reserve(skb, LL_RESERVED_SPACE(dev));
+    skb_reset_mac_header(skb);
+    eth = skb_put_zero(skb, len);
+    rcu_read_lock();
+    peer = rcu_dereference(priv->peer);
+    ether_addr_copy(eth->h_dest, peer ? peer->dev_addr : dev->dev_addr);
+    rcu_read_unlock();
+    ether_addr_copy(eth->h_source, dev->dev_addr);
+    eth->h_proto = htons(ETH_P_IP);
+
+    iph = (struct iphdr *)(eth + 1);
+    iph->version = 4;
+    iph->ihl = sizeof(*iph) / 4;
+    iph->tot_len = htons(len - ETH_HLEN);
+    iph->ttl = 64;
+    iph->protocol = IPPROTO_UDP;
+    iph->saddr = htonl(INZUNET_RX_DADDR);
+    iph->daddr = htonl(INZUNET_RX_SADDR);
+    ip_send_check(iph);
+
+    udph = (struct udphdr *)(iph + 1);
+    udph->source = htons(INZUNET_RX_PORT);
+    udph->dest = htons(INZUNET_RX_PORT);
+    udph->len = htons(len - ETH_HLEN - sizeof(*iph));
+
+    skb_set_network_header(skb, ETH_HLEN);
+    skb_set_transport_header(skb, ETH_HLEN + sizeof(*iph));
+    skb->protocol = htons(ETH_P_IP);
+    skb->dev = dev;
+    return skb;
+}
+
+// Builds a pool of skbs once and keeps sending them. In sink mode skb_get hands the stack an extra reference, our xmit's free
+// only drops that one, so nothing is allocated per packet. An skb someone else still holds (sitting in a qdisc) must not be
+// sent again, skb_shared tells us and we move on. The pair peer's RX side pulls headers and changes the skb, so there each
+// send is a clone instead, which still shares the data and only allocates a head.
+static int inzunet_gen_thread(void *arg)
+{
+    struct inzunet_gen *g = arg;
+    struct net_device *dev = g->dev;
+    struct inzunet_priv *priv = netdev_priv(dev);
+    const u32 pps = priv->gen_cfg.pps;
+    const unsigned int len = clamp_t(unsigned int, priv->gen_cfg.size, ETH_ZLEN, dev->mtu + ETH_HLEN);
+    struct sk_buff *pool[INZUNET_GEN_POOL];
+    unsigned int npool, next = 0;
+    u64 sent = 0;
+
+    for (npool = 0; npool < INZUNET_GEN_POOL; npool++) {
+        pool[npool] = inzunet_gen_build_skb(dev, len);
+        if (!pool[npool])
+            break;
+    }
+
+    while (!kthread_should_stop()) {
+        unsigned int packets = 0, errors = 0, busy = 0, burst = INZUNET_GEN_BURST;
+        bool clone = rcu_access_pointer(priv->peer);
+
+        if (!npool) {
+            schedule_timeout_interruptible(HZ); // couldn't build a single skb, idle until stopped
+            continue;
+        }
+        if (pps) {
+            // same pacing as the RX injector: owe pps * elapsed, sleep when caught up
+            u64 due = mul_u64_u32_div(ktime_get_ns() - g->start_ns, pps, NSEC_PER_SEC);
+
+            if (due <= sent) {
+                usleep_range(20, 50);
+                continue;
+            }
+            burst = min_t(u64, due - sent, INZUNET_GEN_BURST);
+        }
+
+        while (burst--) {
+            struct sk_buff *skb = pool[next];
+
+            if (clone) {
+                skb = skb_clone(skb, GFP_KERNEL);
+                if (!skb) {
+                    errors++;
+                    break;
+                }
+            } else if (skb_shared(skb)) {
+                busy++;
+                break; // the oldest one is still queued, the rest are younger, give the qdisc time to drain
+            } else {
+                skb_get(skb);
+                skb->next = NULL; // our xmit chains skbs through ->next, start each trip clean
+            }
+            next = (next + 1) % npool;
+            if (dev_queue_xmit(skb) == NET_XMIT_SUCCESS)
+                packets++;
+            else
+                errors++;
+        }
+        sent += packets + errors;
+
+        u64_stats_update_begin(&g->syncp);
+        u64_stats_add(&g->packets, packets);
+        u64_stats_add(&g->bytes, (u64)packets * len);
+        u64_stats_add(&g->errors, errors);
+        u64_stats_add(&g->busy, busy);
+        u64_stats_update_end(&g->syncp);
+        if (busy)
+            usleep_range(10, 20);
+        cond_resched(); // flat out we'd never sleep otherwise
+    }
+
+    while (npool--)
+        consume_skb(pool[npool]); // drops our reference, anything still in flight is freed by whoever holds it
+    return 0;
+}
+
+// stops every generator thread, results stay in priv->gen. Called with gen_lock held.
+static void inzunet_gen_stop_locked(struct inzunet_priv *priv)
+{
+    unsigned int i;
+
+    if (!priv->gen_running)
+        return;
+    for (i = 0; i < priv->gen_count; i++) {
+        kthread_stop(priv->gen[i].task);
+        put_task_struct(priv->gen[i].task);
+        priv->gen[i].task = NULL;
+        priv->gen[i].stop_ns = ktime_get_ns();
+    }
+    priv->gen_running = false;
+}
+
+static void inzunet_gen_stop(struct inzunet_priv *priv)
+{
+    mutex_lock(&priv->gen_lock);
+    inzunet_gen_stop_locked(priv);
+    mutex_unlock(&priv->gen_lock);
+}
+
+// starts one thread per CPU (or gen_cfg.threads of them), each bound to its CPU so select_queue sends it out the matching queue
+static int inzunet_gen_start(struct inzunet_priv *priv)
+{
+    struct net_device *dev = priv->dev;
+    unsigned int n = priv->gen_cfg.threads ? priv->gen_cfg.threads : num_online_cpus();
+    unsigned int i;
+    int err = 0;
+
+    n = min(n, num_online_cpus());
+    mutex_lock(&priv->gen_lock);
+    if (priv->gen_running)
+        goto out;
+    // ndo_stop clears this before it calls inzunet_gen_stop, which then waits for us to drop gen_lock
+    if (!netif_running(dev)) {
+        err = -ENETDOWN;
+        goto out;
+    }
+    kfree(priv->gen); // the previous run's results
+    priv->gen = kcalloc(n, sizeof(*priv->gen), GFP_KERNEL);
+    priv->gen_count = 0;
+    if (!priv->gen) {
+        err = -ENOMEM;
+        goto out;
+    }
+
+    for (i = 0; i < n; i++) {
+        struct inzunet_gen *g = &priv->gen[i];
+        struct task_struct *task;
+
+        g->dev = dev;
+        g->cpu = cpumask_local_spread(i, dev_to_node(&dev->dev));
+        u64_stats_init(&g->syncp);
+        g->start_ns = ktime_get_ns();
+        task = kthread_create_on_node(inzunet_gen_thread, g, cpu_to_node(g->cpu), "inzunet_gen/%u", g->cpu);
+        if (IS_ERR(task)) {
+            err = PTR_ERR(task);
+            break;
+        }
+        kthread_bind(task, g->cpu);
+        get_task_struct(task); // kthread_stop needs the task to still be there even if it already returned
+        g->task = task;
+        priv->gen_count++;
+        wake_up_process(task);
+    }
+    priv->gen_running = priv->gen_count > 0;
+    if (err)
+        inzunet_gen_stop_locked(priv); // all or nothing
+out:
+    mutex_unlock(&priv->gen_lock);
+    return err;
+}
+
+static void inzunet_rx_free_flows(struct inzunet_priv *priv)
+{
+    unsigned int i;
+
+    for (i = 0; i < priv->num_queues; i++) {
+        kvfree(priv->queues[i]->rx_flows); // NULL is fine
+        priv->queues[i]->rx_flows = NULL;
+        priv->queues[i]->rx_nflows = 0;
+    }
+}
+
+// lltx was a feature bit until 6.12, see inzunet_setup
+static bool inzunet_is_lltx(const struct net_device *dev)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 12, 0)
+    return dev->lltx;
+#else
+    return dev->features & NETIF_F_LLTX;
+#endif
+}
+
+// tells the core which NAPI serves RX and TX queue n, or that none does (napi NULL, before napi_disable). That's what
+// "ynl --family netdev --dump queue-get" reports, for finding the napi_id to busy poll or the NAPI thread to pin. Our XSK TX
+// runs in the same poll, so the TX queue gets the same NAPI. Called under rtnl.
+// Before 6.13 the NAPI ID is fixed from netif_napi_add on, since then napi_enable assigns it, so refresh the one the XDP RX
+// queue infos were registered with (xdp_rxq_info_reg only stores it). AF_XDP busy polling goes by the XSK one.
+static void inzunet_queue_link_napi(struct inzunet_queue *q, struct napi_struct *napi)
+{
+    netif_queue_set_napi(q->priv->dev, q->index, NETDEV_QUEUE_TYPE_RX, napi);
+    netif_queue_set_napi(q->priv->dev, q->index, NETDEV_QUEUE_TYPE_TX, napi);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+    if (napi) {
+        q->xdp_rxq.napi_id = napi->napi_id;
+        if (xdp_rxq_info_is_reg(&q->xsk_rxq))
+            q->xsk_rxq.napi_id = napi->napi_id;
+    }
+#endif
+}
+
+// Create functions for net_device_ops, recall that net_device_ops manages the callback functions for the net_device's operations
+static int inzunet_open(struct net_device *dev)
+{
+    struct inzunet_priv *priv = netdev_priv(dev);
+    struct net_device *peer;
+    unsigned int i;
+    int err;
+
+    // the frame can't be shorter than the minimum Ethernet frame (or our IPv4/UDP headers), longer than the MTU allows,
+    // or too big for the single page_pool page it's built in
+    priv->rx.size = clamp_t(unsigned int, priv->rx.size, ETH_ZLEN,
+                            min_t(unsigned int, dev->mtu + ETH_HLEN, INZUNET_RX_MAX_FRAME));
+    priv->rx_template = kzalloc(priv->rx.size, GFP_KERNEL);
+    if (!priv->rx_template)
+        return -ENOMEM;
+    priv->rx_len = inzunet_rx_build_template(priv, priv->rx_template);
+    priv->rx_tick_ns = priv->rx.pps > 0 ? max_t(u64, NSEC_PER_SEC / priv->rx.pps, INZUNET_RX_MIN_TICK_NS) : 0;
+
+    // link emulation needs a queue that can stop, so not noqueue/lltx, and only makes sense where xmit is the end of the line
+    priv->link_mbps = priv->link.mbps;
+    priv->link_delay_ns = (u64)priv->link.delay_us * NSEC_PER_USEC;
+    if ((priv->link_mbps || priv->link_delay_ns) && (rcu_access_pointer(priv->peer) || inzunet_is_lltx(dev))) {
+        netdev_warn(dev, "link emulation needs sink mode without lltx, ignoring it\n");
+        priv->link_mbps = 0;
+        priv->link_delay_ns = 0;
+    }
+
+    // take a stable copy of the flow profile, only IPv4 frames have ports and sequence numbers to vary
+    priv->rx_burst = max_t(u32, priv->rx.burst, 1);
+    priv->rx_per_flow = priv->rx.proto == ETH_P_IP;
+    if (priv->rx_per_flow && inzunet_rx_setup_flows(priv)) {
+        err = -ENOMEM;
+        goto err_flows;
+    }
+    for (i = 0; i < priv->num_queues; i++) {
+        err = inzunet_rx_create_pool(priv->queues[i]);
+        if (err)
+            goto err_flows; // the pools that did get built stay for the next try
+    }
+
+    for (i = 0; i < priv->num_queues; i++) {
+        struct inzunet_queue *q = priv->queues[i];
+
+        q->rx_flow = 0;
+        q->rx_burst_left = priv->rx_burst;
+        q->link_next_ns = 0;
+        napi_enable(&q->napi);
+        inzunet_queue_link_napi(q, &q->napi);
+        if (!priv->rx_per_flow || q->rx_nflows) // RSS gave this queue nothing to receive
+            inzunet_rx_start(q);
+        inzunet_rx_kick_ring(q);
+    }
+
+    netif_tx_start_all_queues(dev); // starts every transmit queue, defined in netdevice.h
+    // like veth, a pair end only has carrier while both ends are up, so the stack on either side sees the link as down
+    // (and stops queueing into it) while the other end can't receive
+    peer = rtnl_dereference(priv->peer);
+    if (peer && (peer->flags & IFF_UP)) {
+        netif_carrier_on(dev);
+        netif_carrier_on(peer);
+    }
+    pr_info("inzunet: opened\n"); // macro used for printing informational kernel messages, wraps printk
+    return 0;
+
+err_flows:
+    inzunet_rx_free_flows(priv);
+    kfree(priv->rx_template);
+    priv->rx_template = NULL;
+    return err;
+}
+
+static int inzunet_stop(struct net_device *dev)
+{
+    struct inzunet_priv *priv = netdev_priv(dev);
+    unsigned int i;
+
+    inzunet_gen_stop(priv); // first, on a noqueue device sending to a stopped queue complains loudly
+    netif_tx_stop_all_queues(dev); // stops every transmit queue
+    if (rtnl_dereference(priv->peer)) {
+        netif_carrier_off(dev);
+        netif_carrier_off(rtnl_dereference(priv->peer));
+    }
+
+    for (i = 0; i < priv->num_queues; i++) {
+        struct inzunet_queue *q = priv->queues[i];
+
+        hrtimer_cancel(&q->rx_timer); // first, so nothing schedules the NAPI again
+        inzunet_queue_link_napi(q, NULL);
+        napi_disable(&q->napi); // waits for a running poll to finish, also ends a flat out poll loop
+        inzunet_rx_ring_flush(q); // we're the ring's only consumer again
+        // the qdisc is already deactivated, so no xmit can stop the queue or add to link_delayed any more
+        hrtimer_cancel(&q->link_timer);
+        hrtimer_cancel(&q->delay_timer);
+        skb_queue_purge(&q->link_delayed);
+        // what we just purged never completes, start BQL over. Not in pair mode: skbs still in the peer's ring were sent
+        // through BQL and will complete whenever the peer drains them, resetting would make those completions underflow it.
+        if (!rcu_access_pointer(priv->peer))
+            netdev_tx_reset_queue(netdev_get_tx_queue(dev, i));
+    }
+    inzunet_rx_free_flows(priv);
+    kfree(priv->rx_template);
+    priv->rx_template = NULL;
+    pr_info("inzunet: stopped\n");
+    return 0;
+}
+
+// ndo_select_queue is called by the core before xmit to pick which TX queue (and so which qdisc and lock) a packet goes through.
+// We always pick the sending CPU's queue so CPUs never contend with each other, regardless of what the socket cached.
+static u16 inzunet_select_queue(struct net_device *dev, struct sk_buff *skb, struct net_device *sb_dev)
+{
+    return inzunet_cpu_to_queue(dev, smp_processor_id());
+}
+
+// Buckets the skb for the traffic mix without parsing it. The stack set skb->protocol and the network header before it got
+// here, and a GSO skb's gso_type already says TCP or UDP. Otherwise the L4 protocol is one byte in the IP header the stack
+// just wrote, so it's in cache. IPv6 extension headers aren't walked, such packets only get an L3 bucket. Packets from a
+// packet socket may not have a real network header, the offset and length checks keep us from reading garbage (or past
+// the linear data) for those.
+static void inzunet_tx_classify(const struct sk_buff *skb, struct inzunet_tx_batch *batch, unsigned int packets)
+{
+    int nh = skb_network_offset(skb);
+    u8 l4 = 0;
+
+    switch (skb->protocol) {
+    case htons(ETH_P_IP):
+        batch->l3[INZUNET_L3_IPV4] += packets;
+        if (nh >= ETH_HLEN && nh + sizeof(struct iphdr) <= skb_headlen(skb))
+            l4 = ip_hdr(skb)->protocol;
+        break;
+    case htons(ETH_P_IPV6):
+        batch->l3[INZUNET_L3_IPV6] += packets;
+        if (nh >= ETH_HLEN && nh + sizeof(struct ipv6hdr) <= skb_headlen(skb))
+            l4 = ipv6_hdr(skb)->nexthdr;
+        break;
+    case htons(ETH_P_ARP):
+        batch->l3[INZUNET_L3_ARP] += packets;
+        return;
+    default:
+        batch->l3[INZUNET_L3_OTHER] += packets;
+        return;
+    }
+
+    if (skb_is_gso(skb)) {
+        unsigned int gso_type = skb_shinfo(skb)->gso_type;
+
+        if (gso_type & (SKB_GSO_TCPV4 | SKB_GSO_TCPV6))
+            l4 = IPPROTO_TCP;
+        else if (gso_type & (SKB_GSO_UDP_L4 | SKB_GSO_UDP))
+            l4 = IPPROTO_UDP;
+    }
+    switch (l4) {
+    case IPPROTO_TCP:
+        batch->l4[INZUNET_L4_TCP] += packets;
+        break;
+    case IPPROTO_UDP:
+        batch->l4[INZUNET_L4_UDP] += packets;
+        break;
+    case IPPROTO_ICMP:
+    case IPPROTO_ICMPV6:
+        batch->l4[INZUNET_L4_ICMP] += packets;
+        break;
+    }
+}
+
+// ndo_change_mtu, the core already checked the new MTU against min_mtu/max_mtu. Nothing of ours is sized by the MTU while the
+// device runs: TX frees (or forwards) whatever it gets, the RX injector sizes its frame at ndo_open and keeps it until the next
+// "ip link set up", and pair mode's peer drops anything bigger than its own MTU in __dev_forward_skb like a real link would.
+static int inzunet_change_mtu(struct net_device *dev, int new_mtu)
+{
+    netdev_dbg(dev, "mtu %u -> %d\n", dev->mtu, new_mtu);
+    WRITE_ONCE(dev->mtu, new_mtu); // lockless readers (the TX path, sysfs) use READ_ONCE
+    return 0;
+}
+
+// SO_TIMESTAMPING on TX. skb_tx_timestamp is the software stamp every driver gives right before the packet goes to the
+// hardware, and when the socket asked for a hardware stamp (and SIOCSHWTSTAMP turned TX stamping on) we hand one back right
+// away, taken from the realtime clock since there is no PHC. The wire is never busy, so "handed to us" and "on the wire" are
+// the same moment. Both queue a clone on the socket's error queue, so like every other stack call this stays outside any
+// stats write section.
+static void inzunet_tx_tstamp(struct inzunet_priv *priv, struct sk_buff *skb)
+{
+    if (unlikely(skb_shinfo(skb)->tx_flags & SKBTX_HW_TSTAMP) && READ_ONCE(priv->hwts_tx)) {
+        struct skb_shared_hwtstamps hwts = { .hwtstamp = ktime_get_real() };
+
+        skb_shinfo(skb)->tx_flags |= SKBTX_IN_PROGRESS; // tells skb_tx_timestamp the hardware stamp is taken care of
+        skb_tstamp_tx(skb, &hwts);
+    }
+    skb_tx_timestamp(skb);
+}
+
+// checks and applies a timestamping config. TX is off or on, and since we stamp every frame any RX filter other than NONE
+// becomes ALL, which is what the caller is told back, the same as NICs that can only stamp everything.
+static int inzunet_hwtstamp_apply(struct inzunet_priv *priv, int *tx_type, int *rx_filter)
+{
+    if (*tx_type != HWTSTAMP_TX_OFF && *tx_type != HWTSTAMP_TX_ON)
+        return -ERANGE;
+    if (*rx_filter != HWTSTAMP_FILTER_NONE)
+        *rx_filter = HWTSTAMP_FILTER_ALL;
+    WRITE_ONCE(priv->hwts_tx, *tx_type == HWTSTAMP_TX_ON);
+    WRITE_ONCE(priv->hwts_rx, *rx_filter == HWTSTAMP_FILTER_ALL);
+    return 0;
+}
+
+// SIOCSHWTSTAMP/SIOCGHWTSTAMP (and the netlink equivalent) have their own ndos, the core does the copying from and to
+// userspace and holds rtnl
+static int inzunet_hwtstamp_get(struct net_device *dev, struct kernel_hwtstamp_config *config)
+{
+    struct inzunet_priv *priv = netdev_priv(dev);
+
+    config->flags = 0;
+    config->tx_type = priv->hwts_tx ? HWTSTAMP_TX_ON : HWTSTAMP_TX_OFF;
+    config->rx_filter = priv->hwts_rx ? HWTSTAMP_FILTER_ALL : HWTSTAMP_FILTER_NONE;
+    return 0;
+}
+
+static int inzunet_hwtstamp_set(struct net_device *dev, struct kernel_hwtstamp_config *config, struct netlink_ext_ack *extack)
+{
+    return inzunet_hwtstamp_apply(netdev_priv(dev), &config->tx_type, &config->rx_filter);
+}
+
+// frees every skb in the batch and accounts for all of them with a single counter update. In pair mode nothing is left to free,
+// the skbs are in the peer's ring, so this just accounts for them and wakes the peer's NAPI once for the whole burst.
+static void inzunet_tx_flush(struct inzunet_tx_batch *batch)
+{
+    struct inzunet_pcpu_stats *stats = this_cpu_ptr(batch->q->stats);
+    struct sk_buff *skb = batch->head;
+    // napi_consume_skb with a non zero budget recycles the skb heads into this CPU's cache in bulk. That is only allowed from
+    // softirq/BH disabled context, netpoll can call xmit with irqs off, and budget 0 makes it fall back to dev_consume_skb_any.
+    int budget = in_softirq() && !irqs_disabled() ? batch->count : 0;
+
+    while (skb) {
+        struct sk_buff *next = skb->next;
+
+        skb_mark_not_on_list(skb);
+        napi_consume_skb(skb, budget); // consume rather than kfree, these were delivered not dropped
+        skb = next;
+    }
+
+    u64_stats_update_begin(&stats->syncp); // start of write section, readers that overlap it will retry
+    u64_stats_add(&stats->tx_packets, batch->packets);
+    u64_stats_add(&stats->tx_bytes, batch->bytes);
+    if (batch->count)
+        u64_stats_inc(&stats->tx_batch_hist[ilog2(batch->count)]);
+    u64_stats_add(&stats->tx_dropped, batch->dropped);
+    u64_stats_add(&stats->tx_ring_full, batch->ring_full);
+    u64_stats_add(&stats->tx_link_stops, batch->link_stops);
+    u64_stats_add(&stats->tx_ipv4, batch->l3[INZUNET_L3_IPV4]);
+    u64_stats_add(&stats->tx_ipv6, batch->l3[INZUNET_L3_IPV6]);
+    u64_stats_add(&stats->tx_arp, batch->l3[INZUNET_L3_ARP]);
+    u64_stats_add(&stats->tx_other, batch->l3[INZUNET_L3_OTHER]);
+    u64_stats_add(&stats->tx_tcp, batch->l4[INZUNET_L4_TCP]);
+    u64_stats_add(&stats->tx_udp, batch->l4[INZUNET_L4_UDP]);
+    u64_stats_add(&stats->tx_icmp, batch->l4[INZUNET_L4_ICMP]);
+    u64_stats_update_end(&stats->syncp);
+    if (batch->lat_count) {
+        inzunet_lat_flush(batch->q->priv, batch->lat, true);
+        batch->lat_count = 0;
+    }
+
+    if (batch->peer_rq) {
+        // make the ring writes visible before we look at the NAPI state, pairs with the smp_mb in inzunet_poll
+        smp_mb();
+        napi_schedule(&batch->peer_rq->napi); // runs the peer's RX on this CPU, keeping the sender's cache hot data local (threaded: wakes its kthread)
+        batch->peer_rq = NULL;
+    }
+
+    batch->head = NULL;
+    batch->count = 0;
+    batch->packets = 0;
+    batch->bytes = 0;
+    batch->dropped = 0;
+    batch->ring_full = 0;
+    batch->link_stops = 0;
+    memset(batch->l3, 0, sizeof(batch->l3));
+    memset(batch->l4, 0, sizeof(batch->l4));
+}
+
+// pair mode, turns our TX skb into an RX skb on the peer and queues it on the peer RX queue matching our TX queue.
+// Returns false if it was dropped (and freed).
+static bool inzunet_xmit_peer(struct net_device *peer, struct netdev_queue *txq, struct inzunet_queue *q,
+                              struct sk_buff *skb, struct inzunet_tx_batch *batch)
+{
+    struct inzunet_priv *peer_priv = netdev_priv(peer);
+    struct inzunet_queue *rq = peer_priv->queues[q->index];
+    struct inzunet_ring *r = &rq->ring;
+    unsigned int len = skb->len; // __dev_forward_skb pulls the Ethernet header, BQL wants what the stack handed us
+
+    // Normally we stop the queue before the ring fills (below) so this can't happen, it only can if the peer was just
+    // reconfigured. Returning NETDEV_TX_BUSY is frowned upon, so drop like a NIC with a full RX ring would.
+    if (unlikely(!inzunet_ring_space(r))) {
+        kfree_skb(skb);
+        return false;
+    }
+    // __dev_forward_skb does what veth does: drops (and frees) it if the peer is down or it's bigger than the peer's MTU,
+    // scrubs the TX side state (socket, dst, and netns specific marks), then runs eth_type_trans as the peer
+    if (__dev_forward_skb(peer, skb))
+        return false;
+    INZUNET_SKB_CB(skb)->enq_ns = static_branch_unlikely(&inzunet_lat_key) ? ktime_get_ns() : 0;
+    // BQL: in flight until the peer's NAPI takes it off the ring. Before the produce, the peer may consume it right after.
+    INZUNET_SKB_CB(skb)->bql_len = len;
+    netdev_tx_sent_queue(txq, len);
+    inzunet_ring_produce(r, skb); // no lock, our TX queue lock already guarantees we're the only producer for this ring
+    batch->peer_rq = rq;
+
+    // Backpressure: if that was the last free slot stop our TX queue so the qdisc holds packets (and TCP sees it through TSQ)
+    // instead of us dropping them. The peer's NAPI wakes us once it drains. The barrier and recheck cover the consumer
+    // draining the ring between our space check and the stop, when its wake would have found the queue still running.
+    if (!inzunet_ring_space(r)) {
+        netif_tx_stop_queue(txq);
+        batch->ring_full++;
+        smp_mb(); // pairs with the smp_mb in inzunet_rx_ring_wake
+        r->cached_tail = smp_load_acquire(&r->tail);
+        if (inzunet_ring_space(r) >= inzunet_ring_wake_thresh(r))
+            netif_tx_start_queue(txq);
+    }
+    return true;
+}
+
+// define ndo_start_xmit operation - called by the core kernel when it wants to send a packet out this device.
+// ndo means net_device_ops and xmit means transmit.
+static netdev_tx_t inzunet_start_xmit(struct sk_buff *skb, struct net_device *dev)
+{
+    // netdev_priv(dev) is a helper function that returns a pointer to the private memory area of a net_device struct
+    // there are no fields. This is an area where you can add custom stuff. In this case we defined the custom stuff up top in our struct.
+    struct inzunet_priv *priv = netdev_priv(dev);
+    // the core already picked the queue (see inzunet_select_queue) and stored it in the skb
+    struct inzunet_queue *q = priv->queues[skb_get_queue_mapping(skb)];
+    // xmit runs with bottom halves disabled so we can't migrate CPUs, this_cpu_ptr gives us this CPU's pending batch
+    struct inzunet_tx_batch *batch = this_cpu_ptr(priv->tx_batch);
+    struct netdev_queue *txq = netdev_get_tx_queue(dev, q->index);
+    struct net_device *peer;
+    unsigned int packets;
+    u64 bytes;
+
+    trace_inzunet_xmit(dev, skb, q->index); // no-op unless the tracepoint is enabled
+    if (static_branch_unlikely(&inzunet_cap_key))
+        inzunet_cap(skb, dev, q->index, INZUNET_CAP_TX);
+    if (static_branch_unlikely(&inzunet_log_key) && net_ratelimit())
+        netdev_info(dev, "xmit len=%u proto=0x%04x queue=%u\n", skb->len, ntohs(skb->protocol), q->index);
+
+    if (batch->q && batch->q != q)
+        inzunet_tx_flush(batch); // can't really happen since a burst is always for one queue, but never mix queues in one batch
+    batch->q = q;
+    if (static_branch_unlikely(&inzunet_lat_key))
+        inzunet_tx_lat(skb, batch);
+    inzunet_tx_tstamp(priv, skb); // before the peer path scrubs the socket off the skb
+    // the peer path pulls the Ethernet header and may free the skb, work out what it counts as up front
+    packets = inzunet_skb_wire(skb, skb->len, &bytes);
+    inzunet_tx_classify(skb, batch, packets);
+
+    peer = rcu_dereference_bh(priv->peer); // dev_queue_xmit holds rcu_read_lock_bh for us
+    if (peer) {
+        if (inzunet_xmit_peer(peer, txq, q, skb, batch)) {
+            batch->count++;
+            batch->packets += packets;
+            batch->bytes += bytes;
+        } else {
+            batch->dropped++;
+        }
+    } else if ((priv->link_mbps || priv->link_delay_ns) && inzunet_link_xmit(priv, q, txq, skb, batch)) {
+        // held until the emulated wire (and link delay) is done with it, the delay timer completes and frees it
+        batch->packets += packets;
+        batch->bytes += bytes;
+    } else {
+        // virtual net devices don't actually transmit the packet since theres no real hardware, so no transmission logic needed to be implemented here.
+        // After transmit the skb needs to be freed, but instead of freeing each one we queue it on this CPU's batch and free the burst together.
+        skb->next = batch->head;
+        batch->head = skb;
+        batch->count++;
+        batch->packets += packets;
+        batch->bytes += bytes;
+    }
+
+    // netdev_xmit_more() is true when the stack is about to call us again right away, the last skb of a burst always has it false.
+    // If we just stopped the queue the stack won't call us again until the peer drains, so the burst ends here too.
+    if (!netdev_xmit_more() || netif_xmit_stopped(txq) || batch->count >= INZUNET_TX_BATCH_MAX)
+        inzunet_tx_flush(batch);
+    return NETDEV_TX_OK; // tells the core kernel that the packet was successfully handled by this driver for transmission
+}
+
+// adds one queue's counters, summed over every CPU, into *tot. Takes no locks so it's cheap to call as often as monitoring wants.
+static void inzunet_queue_read_stats(const struct inzunet_queue *q, struct inzunet_stats *tot)
+{
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        const struct inzunet_pcpu_stats *stats = per_cpu_ptr(q->stats, cpu);
+        struct inzunet_stats snap;
+        unsigned int start;
+        int b;
+
+        // re-read if a writer on that CPU was in the middle of an update (only possible on 32 bit)
+        do {
+            start = u64_stats_fetch_begin(&stats->syncp);
+            snap.tx_packets = u64_stats_read(&stats->tx_packets);
+            snap.tx_dropped = u64_stats_read(&stats->tx_dropped);
+            snap.tx_ring_full = u64_stats_read(&stats->tx_ring_full);
+            snap.tx_link_stops = u64_stats_read(&stats->tx_link_stops);
+            snap.tx_link_stopped_ns = u64_stats_read(&stats->tx_link_stopped_ns);
+            snap.tx_ipv4 = u64_stats_read(&stats->tx_ipv4);
+            snap.tx_ipv6 = u64_stats_read(&stats->tx_ipv6);
+            snap.tx_arp = u64_stats_read(&stats->tx_arp);
+            snap.tx_other = u64_stats_read(&stats->tx_other);
+            snap.tx_tcp = u64_stats_read(&stats->tx_tcp);
+            snap.tx_udp = u64_stats_read(&stats->tx_udp);
+            snap.tx_icmp = u64_stats_read(&stats->tx_icmp);
+            snap.tx_bytes = u64_stats_read(&stats->tx_bytes);
+            for (b = 0; b < INZUNET_BATCH_BUCKETS; b++)
+                snap.tx_batch_hist[b] = u64_stats_read(&stats->tx_batch_hist[b]);
+            snap.rx_packets = u64_stats_read(&stats->rx_packets);
+            snap.rx_bytes = u64_stats_read(&stats->rx_bytes);
+            snap.rx_dropped = u64_stats_read(&stats->rx_dropped);
+            snap.rx_ring_wakeups = u64_stats_read(&stats->rx_ring_wakeups);
+            snap.rx_gro_merged = u64_stats_read(&stats->rx_gro_merged);
+            snap.xdp_pass = u64_stats_read(&stats->xdp_pass);
+            snap.xdp_drop = u64_stats_read(&stats->xdp_drop);
+            snap.xdp_tx = u64_stats_read(&stats->xdp_tx);
+            snap.xdp_redirect = u64_stats_read(&stats->xdp_redirect);
+            snap.xdp_aborted = u64_stats_read(&stats->xdp_aborted);
+            snap.xdp_xmit_packets = u64_stats_read(&stats->xdp_xmit_packets);
+            snap.xdp_xmit_bytes = u64_stats_read(&stats->xdp_xmit_bytes);
+            snap.xdp_xmit_bulks = u64_stats_read(&stats->xdp_xmit_bulks);
+            snap.xsk_tx_packets = u64_stats_read(&stats->xsk_tx_packets);
+            snap.xsk_tx_bytes = u64_stats_read(&stats->xsk_tx_bytes);
+        } while (u64_stats_fetch_retry(&stats->syncp, start));
+
+        tot->tx_packets += snap.tx_packets;
+        tot->tx_dropped += snap.tx_dropped;
+        tot->tx_ring_full += snap.tx_ring_full;
+        tot->tx_link_stops += snap.tx_link_stops;
+        tot->tx_link_stopped_ns += snap.tx_link_stopped_ns;
+        tot->tx_ipv4 += snap.tx_ipv4;
+        tot->tx_ipv6 += snap.tx_ipv6;
+        tot->tx_arp += snap.tx_arp;
+        tot->tx_other += snap.tx_other;
+        tot->tx_tcp += snap.tx_tcp;
+        tot->tx_udp += snap.tx_udp;
+        tot->tx_icmp += snap.tx_icmp;
+        tot->tx_bytes += snap.tx_bytes;
+        for (b = 0; b < INZUNET_BATCH_BUCKETS; b++)
+            tot->tx_batch_hist[b] += snap.tx_batch_hist[b];
+        tot->rx_packets += snap.rx_packets;
+        tot->rx_bytes += snap.rx_bytes;
+        tot->rx_dropped += snap.rx_dropped;
+        tot->rx_ring_wakeups += snap.rx_ring_wakeups;
+        tot->rx_gro_merged += snap.rx_gro_merged;
+        tot->xdp_pass += snap.xdp_pass;
+        tot->xdp_drop += snap.xdp_drop;
+        tot->xdp_tx += snap.xdp_tx;
+        tot->xdp_redirect += snap.xdp_redirect;
+        tot->xdp_aborted += snap.xdp_aborted;
+        tot->xdp_xmit_packets += snap.xdp_xmit_packets;
+        tot->xdp_xmit_bytes += snap.xdp_xmit_bytes;
+        tot->xdp_xmit_bulks += snap.xdp_xmit_bulks;
+        tot->xsk_tx_packets += snap.xsk_tx_packets;
+        tot->xsk_tx_bytes += snap.xsk_tx_bytes;
+    }
+}
+
+// whole device totals, every queue added together
+static void inzunet_read_stats(const struct inzunet_priv *priv, struct inzunet_stats *tot)
+{
+    unsigned int i;
+
+    for (i = 0; i < priv->num_queues; i++)
+        inzunet_queue_read_stats(priv->queues[i], tot);
+}
+
+// ndo_get_stats64 is what "ip -s link" and /sys/class/net/*/statistics read. The core calls it without rtnl and we take no
+// locks of our own, the u64_stats retry loop is all the synchronization needed, so scraping it every second costs nothing.
+static void inzunet_get_stats64(struct net_device *dev, struct rtnl_link_stats64 *tot)
+{
+    struct inzunet_stats stats = {};
+
+    inzunet_read_stats(netdev_priv(dev), &stats);
+    tot->tx_packets = stats.tx_packets;
+    tot->tx_bytes = stats.tx_bytes;
+    tot->tx_dropped = stats.tx_dropped;
+    tot->rx_packets = stats.rx_packets;
+    tot->rx_bytes = stats.rx_bytes;
+    tot->rx_dropped = stats.rx_dropped;
+}
+
+// swaps the attached XDP program, prog is NULL when detaching. The core already took a reference to prog for us.
+static int inzunet_xdp_setup(struct net_device *dev, struct bpf_prog *prog, struct netlink_ext_ack *extack)
+{
+    struct inzunet_priv *priv = netdev_priv(dev);
+    struct bpf_prog *old;
+
+    // the NAPI polls pick up the new program on their next poll, whoever still runs the old one is inside an RCU read section
+    // and bpf_prog_put only frees it after a grace period
+    old = rcu_replace_pointer(priv->xdp_prog, prog, lockdep_rtnl_is_held());
+    if (old)
+        bpf_prog_put(old);
+    return 0;
+}
+
+// stops a running queue's RX side so its NAPI state can be swapped, and starts it again. Same steps as ndo_stop/ndo_open.
+static void inzunet_queue_quiesce(struct inzunet_queue *q)
+{
+    hrtimer_cancel(&q->rx_timer);
+    napi_disable(&q->napi);
+}
+
+static void inzunet_queue_resume(struct inzunet_queue *q)
+{
+    napi_enable(&q->napi);
+    if (!q->priv->rx_per_flow || q->rx_nflows)
+        inzunet_rx_start(q);
+    inzunet_rx_kick_ring(q);
+}
+
+// an AF_XDP socket binding to (or, pool NULL, unbinding from) queue qid in zero-copy mode. Called under rtnl. There's no
+// device memory to DMA map the UMEM for, so unlike a NIC driver we skip xsk_pool_dma_map and the pool hands out plain
+// addresses we memcpy into.
+static int inzunet_xsk_pool_setup(struct net_device *dev, struct xsk_buff_pool *pool, u16 qid)
+{
+    struct inzunet_priv *priv = netdev_priv(dev);
+    bool running = netif_running(dev);
+    struct inzunet_queue *q;
+    int err;
+
+    if (qid >= priv->num_queues)
+        return -EINVAL;
+    q = priv->queues[qid];
+    if (pool) {
+        if (q->xsk_pool)
+            return -EBUSY;
+        err = xdp_rxq_info_reg(&q->xsk_rxq, dev, qid, q->napi.napi_id);
+        if (err)
+            return err;
+        err = xdp_rxq_info_reg_mem_model(&q->xsk_rxq, MEM_TYPE_XSK_BUFF_POOL, NULL);
+        if (err) {
+            xdp_rxq_info_unreg(&q->xsk_rxq);
+            return err;
+        }
+        xsk_pool_set_rxq_info(pool, &q->xsk_rxq); // buffers the pool hands out point at xsk_rxq
+    } else if (!q->xsk_pool) {
+        return -EINVAL;
+    }
+
+    // the poll reads xsk_pool without locks, so it only changes while the NAPI can't run
+    if (running)
+        inzunet_queue_quiesce(q);
+    q->xsk_pool = pool;
+    if (running)
+        inzunet_queue_resume(q);
+
+    if (!pool)
+        xdp_rxq_info_unreg(&q->xsk_rxq);
+    return 0;
+}
+
+// ndo_bpf is the single entry point for everything BPF/XDP wants from a driver, bpf->command says what
+static int inzunet_bpf(struct net_device *dev, struct netdev_bpf *bpf)
+{
+    switch (bpf->command) {
+    case XDP_SETUP_PROG:
+        return inzunet_xdp_setup(dev, bpf->prog, bpf->extack);
+    case XDP_SETUP_XSK_POOL:
+        return inzunet_xsk_pool_setup(dev, bpf->xsk.pool, bpf->xsk.queue_id);
+    default:
+        return -EINVAL;
+    }
+}
+
+// ndo_xsk_wakeup is what sendto/poll on an AF_XDP socket calls when need_wakeup is set (or always without it), our stand in
+// for the NIC interrupt. Scheduling the NAPI from here runs this poll on the calling CPU, which is the same CPU the socket is
+// busy on and saves an IPI per kick.
+static int inzunet_xsk_wakeup(struct net_device *dev, u32 qid, u32 flags)
+{
+    struct inzunet_priv *priv = netdev_priv(dev);
+
+    if (!netif_running(dev))
+        return -ENETDOWN;
+    if (qid >= priv->num_queues || !READ_ONCE(priv->queues[qid]->xsk_pool))
+        return -EINVAL;
+    // BH disabled so the NAPI softirq runs as soon as we re-enable, napi_schedule does nothing if a poll is already pending
+    local_bh_disable();
+    napi_schedule(&priv->queues[qid]->napi);
+    local_bh_enable();
+    return 0;
+}
+
+// ndo_xdp_xmit is what a devmap/cpumap redirect (or XDP_REDIRECT from another driver) calls to hand us frames. The redirect
+// code already batches them per destination device, so we get up to XDP_BULK_QUEUE_SIZE frames per call and handle the whole
+// array at once: one pass to add up the bytes and put the frames back to whoever owns their memory, one stats update at the end.
+// Returns how many frames we took, the caller frees the rest, we always take them all.
+static int inzunet_xdp_xmit(struct net_device *dev, int n, struct xdp_frame **frames, u32 flags)
+{
+    struct inzunet_priv *priv = netdev_priv(dev);
+    struct inzunet_pcpu_stats *stats;
+    struct inzunet_queue *q;
+    struct xdp_frame_bulk bq;
+    u64 bytes = 0;
+    int i;
+
+    if (unlikely(flags & ~XDP_XMIT_FLAGS_MASK))
+        return -EINVAL;
+    // XDP_XMIT_FLUSH asks us to ring the doorbell, there is no hardware queue, every frame is already "sent" when we return
+
+    // called from the redirect flush in softirq, so we stay on this CPU and can count on the queue it would transmit on
+    q = priv->queues[inzunet_cpu_to_queue(dev, smp_processor_id())];
+
+    // the bulk return groups frames by memory owner, frames from a page_pool go back to it in one go instead of one at a time
+    xdp_frame_bulk_init(&bq);
+    rcu_read_lock(); // xdp_return_frame_bulk looks up the frame's memory model under RCU
+    for (i = 0; i < n; i++) {
+        bytes += xdp_get_frame_len(frames[i]);
+        xdp_return_frame_bulk(frames[i], &bq);
+    }
+    xdp_flush_frame_bulk(&bq);
+    rcu_read_unlock();
+
+    stats = this_cpu_ptr(q->stats);
+    u64_stats_update_begin(&stats->syncp);
+    u64_stats_add(&stats->xdp_xmit_packets, n);
+    u64_stats_add(&stats->xdp_xmit_bytes, bytes);
+    u64_stats_inc(&stats->xdp_xmit_bulks);
+    u64_stats_update_end(&stats->syncp);
+    return n;
+}
+
+// --- ethtool ---
+
+static u32 inzunet_get_rxfh_key_size(struct net_device *dev)
+{
+    return INZUNET_RSS_KEY_SIZE;
+}
+
+static u32 inzunet_get_rxfh_indir_size(struct net_device *dev)
+{
+    return INZUNET_RSS_INDIR_SIZE;
+}
+
+// "ethtool -x inzunet0"
+static int inzunet_get_rxfh(struct net_device *dev, struct ethtool_rxfh_param *rxfh)
+{
+    struct inzunet_priv *priv = netdev_priv(dev);
+
+    rxfh->hfunc = ETH_RSS_HASH_TOP;
+    if (rxfh->indir)
+        memcpy(rxfh->indir, priv->rss_indir, sizeof(priv->rss_indir));
+    if (rxfh->key)
+        memcpy(rxfh->key, priv->rss_key, sizeof(priv->rss_key));
+    return 0;
+}
+
+// "ethtool -X inzunet0 equal 2" or "weight 1 0 3" etc. The core already checked every entry is a valid queue. Flows are
+// steered when the device opens, so a running device picks the new table up after ip link set down/up.
+static int inzunet_set_rxfh(struct net_device *dev, struct ethtool_rxfh_param *rxfh, struct netlink_ext_ack *extack)
+{
+    struct inzunet_priv *priv = netdev_priv(dev);
+
+    if (rxfh->hfunc != ETH_RSS_HASH_NO_CHANGE && rxfh->hfunc != ETH_RSS_HASH_TOP)
+        return -EOPNOTSUPP; // Toeplitz is all we do
+    if (rxfh->indir)
+        memcpy(priv->rss_indir, rxfh->indir, sizeof(priv->rss_indir));
+    if (rxfh->key)
+        memcpy(priv->rss_key, rxfh->key, sizeof(priv->rss_key));
+    if (netif_running(dev))
+        netdev_info(dev, "RSS table updated, takes effect on the next open\n");
+    return 0;
+}
+
+// ethtool -X refuses to touch the table unless it can ask how many RX rings there are
+static int inzunet_get_rxnfc(struct net_device *dev, struct ethtool_rxnfc *info, u32 *rule_locs)
+{
+    switch (info->cmd) {
+    case ETHTOOL_GRXRINGS:
+        info->data = dev->real_num_rx_queues;
+        return 0;
+    case ETHTOOL_GRXFH:
+        // "ethtool -n inzunet0 rx-flow-hash tcp4", the only flows we generate are IPv4 TCP/UDP hashed on the 4-tuple
+        if (info->flow_type != TCP_V4_FLOW && info->flow_type != UDP_V4_FLOW)
+            return -EINVAL;
+        info->data = RXH_IP_SRC | RXH_IP_DST | RXH_L4_B_0_1 | RXH_L4_B_2_3;
+        return 0;
+    default:
+        return -EOPNOTSUPP;
+    }
+}
 
-// we define this structure and will use it for the net_device private area below
-struct inzunet_priv {
-        atomic64_t tx_packets;
-        atomic64_t tx_bytes;
-};
+static u64 *inzunet_stat_ptr(struct inzunet_stats *stats, unsigned int i)
+{
+    return (u64 *)((u8 *)stats + inzunet_stat_descs[i].offset);
+}
 
-// net_device struct, is the standard way of representing network devices
-// you don't allocate this manually (you can but you shouldn't), you use alloc_netdev. alloc_netdev takes care of correctly allocating the net_device struct.
-static struct net_device *inzunet_dev;
-static struct proc_dir_entry *inzunet_proc_entry; // holds to /proc/inzunet_stats file entry for cleanup
+static int inzunet_get_sset_count(struct net_device *dev, int sset)
+{
+    struct inzunet_priv *priv = netdev_priv(dev);
+    int count;
 
-// Create functions for net_device_ops, recall that net_device_ops manages the callback functions for the net_device's operations
-static int inzunet_open(struct net_device *dev)
+    if (sset != ETH_SS_STATS)
+        return -EOPNOTSUPP;
+    // device totals, the batch histogram, then every queue
+    count = INZUNET_NUM_STATS + INZUNET_BATCH_BUCKETS + INZUNET_NUM_STATS * priv->num_queues;
+#ifdef CONFIG_PAGE_POOL_STATS
+    count += page_pool_ethtool_stats_get_count(); // all queues' RX page_pools added together
+#endif
+    return count;
+}
+
+// the names, in exactly the order inzunet_get_ethtool_stats fills in the values
+static void inzunet_get_strings(struct net_device *dev, u32 sset, u8 *data)
 {
-    netif_start_queue(dev); // starts transmit queue, defined in netdevice.h
-    pr_info("inzunet: opened\n"); // macro used for printing informational kernel messages, wraps printk
-    return 0;
+    struct inzunet_priv *priv = netdev_priv(dev);
+    unsigned int i, b;
+
+    if (sset != ETH_SS_STATS)
+        return;
+    for (i = 0; i < INZUNET_NUM_STATS; i++)
+        ethtool_sprintf(&data, "%s", inzunet_stat_descs[i].name);
+    for (b = 0; b < INZUNET_BATCH_BUCKETS; b++)
+        ethtool_sprintf(&data, "tx_batch_%u_%u", 1U << b, min((2U << b) - 1, (unsigned int)INZUNET_TX_BATCH_MAX));
+    for (b = 0; b < priv->num_queues; b++)
+        for (i = 0; i < INZUNET_NUM_STATS; i++)
+            ethtool_sprintf(&data, "queue%u_%s", b, inzunet_stat_descs[i].name);
+#ifdef CONFIG_PAGE_POOL_STATS
+    page_pool_ethtool_stats_get_strings(data);
+#endif
 }
 
-static int inzunet_stop(struct net_device *dev)
+// "ethtool -S inzunet0". Like ndo_get_stats64 this takes no locks, each queue is summed over the CPUs once and the device
+// totals are added up from those same per-queue snapshots, so the totals always match the per-queue numbers next to them.
+static void inzunet_get_ethtool_stats(struct net_device *dev, struct ethtool_stats *estats, u64 *data)
 {
-    netif_stop_queue(dev); // stops transmit queue
-    pr_info("inzunet: stopped\n");
+    struct inzunet_priv *priv = netdev_priv(dev);
+    struct inzunet_stats tot = {};
+    u64 *qdata = data + INZUNET_NUM_STATS + INZUNET_BATCH_BUCKETS; // the per-queue part comes after the totals
+    unsigned int i, b;
+#ifdef CONFIG_PAGE_POOL_STATS
+    struct page_pool_stats ps = {};
+#endif
+
+    for (b = 0; b < priv->num_queues; b++) {
+        struct inzunet_stats qstats = {};
+
+        inzunet_queue_read_stats(priv->queues[b], &qstats);
+        for (i = 0; i < INZUNET_NUM_STATS; i++) {
+            *qdata++ = *inzunet_stat_ptr(&qstats, i);
+            *inzunet_stat_ptr(&tot, i) += *inzunet_stat_ptr(&qstats, i);
+        }
+        for (i = 0; i < INZUNET_BATCH_BUCKETS; i++)
+            tot.tx_batch_hist[i] += qstats.tx_batch_hist[i];
+#ifdef CONFIG_PAGE_POOL_STATS
+        if (priv->queues[b]->page_pool) // not built before the first open
+            page_pool_get_stats(priv->queues[b]->page_pool, &ps); // adds into ps
+#endif
+    }
+
+    for (i = 0; i < INZUNET_NUM_STATS; i++)
+        *data++ = *inzunet_stat_ptr(&tot, i);
+    for (i = 0; i < INZUNET_BATCH_BUCKETS; i++)
+        *data++ = tot.tx_batch_hist[i];
+#ifdef CONFIG_PAGE_POOL_STATS
+    page_pool_ethtool_stats_get(qdata, &ps);
+#endif
+}
+
+// what "ethtool -T" shows and what PTP/SO_TIMESTAMPING tooling checks before asking for hardware stamps. There is no PHC to
+// read the clock from, so phc_index is -1 and the stamps are on CLOCK_REALTIME. 6.11 switched to the kernel internal struct.
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 11, 0)
+static int inzunet_get_ts_info(struct net_device *dev, struct kernel_ethtool_ts_info *info)
+#else
+static int inzunet_get_ts_info(struct net_device *dev, struct ethtool_ts_info *info)
+#endif
+{
+    info->so_timestamping = SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE |
+                            SOF_TIMESTAMPING_TX_HARDWARE | SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE;
+    info->phc_index = -1;
+    info->tx_types = BIT(HWTSTAMP_TX_OFF) | BIT(HWTSTAMP_TX_ON);
+    info->rx_filters = BIT(HWTSTAMP_FILTER_NONE) | BIT(HWTSTAMP_FILTER_ALL);
     return 0;
 }
 
-// define ndo_start_xmit operation - called by the core kernel when it wants to send a packet out this device.
-// ndo means net_device_ops and xmit means transmit.
-static netdev_tx_t inzunet_start_xmit(struct sk_buff *skb, struct net_device *dev)
+// "ethtool inzunet0" shows the emulated link speed, tools that size things by link speed (tc, some BQL tuning) read it too
+static int inzunet_get_link_ksettings(struct net_device *dev, struct ethtool_link_ksettings *cmd)
 {
-    // netdev_priv(dev) is a helper function that returns a pointer to the private memory area of a net_device struct
-    // there are no fields. This is an area where you can add custom stuff. In this case we defined the custom stuff up top in our struct.
     struct inzunet_priv *priv = netdev_priv(dev);
+    u32 mbps = netif_running(dev) ? priv->link_mbps : priv->link.mbps;
 
-    atomic64_inc(&priv->tx_packets); // increments the number of TX packets  using atomic operation
-        atomic64_add(skb->len, &priv->tx_bytes); // increments the total byte count using atomic operation
-
-    pr_info("inzunet: xmit len=%u proto=0x%04x\n", skb->len, ntohs(skb->protocol));
-    // virtual net devices don't actually transmit the packet since theres no real hardware, so no transmission logic needed to be implemented here
-    dev_kfree_skb(skb); // after transmit code is done, the skb needs to be freed and this also decrements reference count since skb can be shared across layers
-    return NETDEV_TX_OK; // tells the core kernel that the packet was successfully handled by this driver for transmission
+    cmd->base.speed = mbps ? mbps : SPEED_UNKNOWN;
+    cmd->base.duplex = DUPLEX_FULL;
+    cmd->base.port = PORT_NONE;
+    cmd->base.autoneg = AUTONEG_DISABLE;
+    return 0;
 }
 
+static const struct ethtool_ops inzunet_ethtool_ops = {
+    .get_link            = ethtool_op_get_link,
+    .get_link_ksettings  = inzunet_get_link_ksettings,
+    .get_sset_count      = inzunet_get_sset_count,
+    .get_strings         = inzunet_get_strings,
+    .get_ethtool_stats   = inzunet_get_ethtool_stats,
+    .get_rxnfc           = inzunet_get_rxnfc,
+    .get_rxfh_key_size   = inzunet_get_rxfh_key_size,
+    .get_rxfh_indir_size = inzunet_get_rxfh_indir_size,
+    .get_rxfh            = inzunet_get_rxfh,
+    .set_rxfh            = inzunet_set_rxfh,
+    .get_ts_info         = inzunet_get_ts_info,
+};
+
 // net_device_ops manages the callback functions for the network device's operations
 // these are the basics for a network device to function
 static const struct net_device_ops inzunet_netdev_ops = {
-    .ndo_open       = inzunet_open, // optional, but packet transmission won't happen without this
-    .ndo_stop       = inzunet_stop, // optional, but packet transmission won't happen without this
-    .ndo_start_xmit = inzunet_start_xmit, // required, if null the kernel core will refuse to register it
+    .ndo_init         = inzunet_dev_init, // optional, allocates per-queue state
+    .ndo_uninit       = inzunet_dev_uninit, // optional, frees per-queue state
+    .ndo_open         = inzunet_open, // optional, but packet transmission won't happen without this
+    .ndo_stop         = inzunet_stop, // optional, but packet transmission won't happen without this
+    .ndo_start_xmit   = inzunet_start_xmit, // required, if null the kernel core will refuse to register it
+    .ndo_select_queue = inzunet_select_queue, // optional, without it the core hashes flows onto queues
+    .ndo_get_stats64  = inzunet_get_stats64, // optional, without it the core reports the (unused) dev->stats
+    .ndo_change_mtu   = inzunet_change_mtu, // optional, without it the core just sets dev->mtu itself
+    .ndo_hwtstamp_get = inzunet_hwtstamp_get, // optional, SIOCGHWTSTAMP, "hwstamp_ctl -i inzunet0"
+    .ndo_hwtstamp_set = inzunet_hwtstamp_set, // optional, SIOCSHWTSTAMP
+    .ndo_bpf          = inzunet_bpf, // optional, lets "ip link set dev inzunet0 xdp obj prog.o" attach natively instead of generic XDP
+    .ndo_xdp_xmit     = inzunet_xdp_xmit, // optional, makes us a valid target for bpf_redirect/bpf_redirect_map
+    .ndo_xsk_wakeup   = inzunet_xsk_wakeup, // optional, required for AF_XDP zero-copy binds
 };
 
 // called by alloc_netdev, used to initialize the net_device that alloc_netdev creates
 static void inzunet_setup(struct net_device *dev)
 {
+    struct inzunet_priv *priv = netdev_priv(dev);
+
     ether_setup(dev); // set up ethernet-like defaults for your net_device
     dev->netdev_ops = &inzunet_netdev_ops;
+    dev->ethtool_ops = &inzunet_ethtool_ops;
+    dev->needs_free_netdev = true; // the core frees the net_device after unregistering it, there is no one left to do it later
+    dev->priv_destructor = inzunet_free_queue_mem; // just before that, see inzunet_free_queues
+    INIT_LIST_HEAD(&priv->list);
+    mutex_init(&priv->lat_lock);
+    mutex_init(&priv->gen_lock);
+    priv->gen_cfg.size = ETH_ZLEN;
     dev->flags |= IFF_NOARP; // disables ARP, ARP is optional since it's virtual
+    eth_hw_addr_random(dev); // give the device a random locally administered MAC, synthetic RX frames are addressed to it
+    // advertised over netlink: PASS/DROP/TX/ABORTED, REDIRECT out of our RX, being a redirect target (ndo_xdp_xmit), and AF_XDP
+    // zero-copy, without XSK_ZEROCOPY the core only allows copy mode binds
+    dev->xdp_features = NETDEV_XDP_ACT_BASIC | NETDEV_XDP_ACT_REDIRECT | NETDEV_XDP_ACT_NDO_XMIT | NETDEV_XDP_ACT_XSK_ZEROCOPY;
     // Set transmit queue length, since we immediately free the packet, this should never really fill up.
     // When full, the kernel core starts and stops transmit queue automatically. That doesn't mean the tx queue ceases to exist, it always exists, it just stops momentarily.
     // By stopping it just means the kernel stops accepting packets for transmit. So apps sending to the kernel are blocked. Packets won't be dropped unless the app can't wait
     // and tries sending the packet.
-    // Each net_device has 1 tx queue. Note: it can have more if there is multiple CPUs and you allow it, that would be represented by netdev->num_tx_queues
+    // tx_queue_len is per TX queue. We allocate numqueues of them in alloc_netdev_mqs, that is represented by netdev->num_tx_queues
     dev->tx_queue_len = 1000;
+
+    // hw_features is what ethtool may toggle, features is what is on right now. TSO needs SG and checksum offload, if someone
+    // turns those off with ethtool the core's netdev_fix_features drops TSO too. HW_CSUM means we can "checksum" anything,
+    // which is true since nothing ever checks, and HIGHDMA says we can take pages from any physical address.
+    dev->hw_features = NETIF_F_SG | NETIF_F_HW_CSUM | NETIF_F_HIGHDMA | NETIF_F_TSO | NETIF_F_TSO6 | NETIF_F_GSO_SOFTWARE;
+    if (offloads)
+        dev->features |= dev->hw_features;
+
+    // ether_setup caps the MTU at 1500, there's no wire here so take anything up to what an IPv4 packet can hold. Jumbo skbs
+    // are linear or page frags either way, TX never looks inside. RX injector frames stay within one page (INZUNET_RX_MAX_FRAME)
+    // since native XDP needs the whole frame in one buffer.
+    dev->min_mtu = ETH_MIN_MTU;
+    dev->max_mtu = ETH_MAX_MTU;
+    // BIG TCP: the core caps GSO skbs at tso_max_size, 64K unless the driver says otherwise. Raising it only allows a bigger
+    // gso_max_size (and gso_ipv4_max_size), the default stays 64K until "ip link set inzunet0 gso_max_size 185000" asks for more.
+    // Then TCP hands xmit one skb per ~185K instead of three, which is the per-packet cost the benchmark wants to see shrink.
+    netif_set_tso_max_size(dev, GSO_MAX_SIZE);
+
+    // the pair ring relies on the TX queue lock to have a single producer, so pair mode always keeps the lock, and so does
+    // link emulation, which also has to be able to stop the queue
+    if (lltx && !pair && !link_mbps && !link_delay_us) {
+        // LLTX means "lockless TX", the core calls ndo_start_xmit without holding the TX queue lock.
+        // It was a feature bit until 6.12 turned it into a plain field on net_device.
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 12, 0)
+        dev->lltx = true;
+#else
+        dev->features |= NETIF_F_LLTX;
+#endif
+        // IFF_NO_QUEUE makes the core attach the noqueue qdisc, packets go straight from dev_queue_xmit to us.
+        // With noqueue the device must never stop its queues, which is fine since we never do.
+        dev->priv_flags |= IFF_NO_QUEUE;
+        dev->tx_queue_len = 0;
+    }
+
+    // RX injector settings start out as the module parameters
+    priv->rx.pps = rx_pps;
+    priv->rx.size = rx_size;
+    priv->rx.proto = rx_proto;
+    priv->rx.flows = 1;
+    priv->rx.burst = 1;
+    priv->link.mbps = link_mbps;
+    priv->link.delay_us = link_delay_us;
+}
+
+// /sys/kernel/debug/inzunet/<name>/ holds the RX flow profile knobs, written with echo and applied on the next ip link set up.
+// debugfs is one tree for the whole system but interface names are only unique within a netns, and every test netns can have
+// its own inzunet0. So <name> is the interface name for devices in the initial netns and "<netns inode>-<ifname>" for the
+// rest, the inode being the N in "readlink /proc/<pid>/ns/net" = net:[N] (or "stat -L -c %i /run/netns/<name>").
+// debugfs is for debugging only and has no stable ABI, which is exactly what a benchmark knob wants.
+// Failing to create any of it is not an error, the debugfs api is built so callers never have to check.
+// any write to latency_reset starts the histograms over, "echo 1 > /sys/kernel/debug/inzunet/inzunet0/latency_reset"
+static ssize_t inzunet_lat_reset_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos)
+{
+    struct inzunet_priv *priv = file->private_data;
+    struct inzunet_lat now = {};
+
+    inzunet_read_lat(priv, &now, false);
+    mutex_lock(&priv->lat_lock);
+    priv->lat_base = now;
+    mutex_unlock(&priv->lat_lock);
+    return count;
+}
+
+static const struct file_operations inzunet_lat_reset_fops = {
+    .owner = THIS_MODULE,
+    .open  = simple_open, // file->private_data = the priv we passed to debugfs_create_file
+    .write = inzunet_lat_reset_write,
+};
+
+// tx_gen: "echo 1 > tx_gen" starts the generator with the tx_gen_* settings, "echo 0" stops it, reading says whether it runs
+static ssize_t inzunet_gen_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos)
+{
+    struct inzunet_priv *priv = file->private_data;
+    bool on;
+    int err;
+
+    err = kstrtobool_from_user(buf, count, &on);
+    if (err)
+        return err;
+    if (on)
+        err = inzunet_gen_start(priv);
+    else
+        inzunet_gen_stop(priv);
+    return err ? err : count;
+}
+
+static ssize_t inzunet_gen_read(struct file *file, char __user *buf, size_t count, loff_t *ppos)
+{
+    struct inzunet_priv *priv = file->private_data;
+    char state[3] = { READ_ONCE(priv->gen_running) ? '1' : '0', '\n', 0 };
+
+    return simple_read_from_buffer(buf, count, ppos, state, 2);
+}
+
+static const struct file_operations inzunet_gen_fops = {
+    .owner = THIS_MODULE,
+    .open  = simple_open,
+    .read  = inzunet_gen_read,
+    .write = inzunet_gen_write,
+};
+
+// queue_cpu: reading lists "queue cpu node" per queue, "echo '2 5' > queue_cpu" moves queue 2's NAPI and RX timer to CPU 5 from
+// the next ip link set up, like echoing a NIC IRQ's smp_affinity. The device has to be down, a running queue would need its
+// NAPI and timers torn down and set up again elsewhere, which is what down/up already does. The RX page pool and the flow table
+// (allocated at open) follow the move, the queue struct and its ring stay on the node ndo_init put them on (reload with
+// queue_cpu= to place those too).
+static int inzunet_queue_cpu_show(struct seq_file *m, void *v)
+{
+    struct inzunet_priv *priv = m->private;
+    unsigned int i;
+
+    for (i = 0; i < priv->num_queues; i++) {
+        unsigned int cpu = READ_ONCE(priv->queues[i]->cpu);
+
+        seq_printf(m, "%u %u %d\n", i, cpu, cpu_to_node(cpu));
+    }
+    return 0;
+}
+
+static int inzunet_queue_cpu_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, inzunet_queue_cpu_show, inode->i_private);
+}
+
+static ssize_t inzunet_queue_cpu_write(struct file *file, const char __user *ubuf, size_t count, loff_t *ppos)
+{
+    struct inzunet_priv *priv = ((struct seq_file *)file->private_data)->private;
+    unsigned int qid, cpu;
+    char buf[32];
+    int err = 0;
+
+    if (count >= sizeof(buf))
+        return -EINVAL;
+    if (copy_from_user(buf, ubuf, count))
+        return -EFAULT;
+    buf[count] = 0;
+    if (sscanf(buf, "%u %u", &qid, &cpu) != 2)
+        return -EINVAL;
+    if (qid >= priv->num_queues || cpu >= nr_cpu_ids || !cpu_online(cpu))
+        return -EINVAL;
+
+    // ndo_open reads q->cpu under rtnl. Waiting for rtnl here could deadlock against unregister, which removes this file under
+    // rtnl and waits for writers like us to finish, so back off and let the syscall restart instead, as net-sysfs does.
+    if (!rtnl_trylock())
+        return restart_syscall();
+    if (netif_running(priv->dev)) {
+        err = -EBUSY;
+    } else {
+        struct inzunet_queue *q = priv->queues[qid];
+
+        WRITE_ONCE(q->cpu, cpu);
+        // the NAPI is disabled while the device is down, so nothing races the pool's NAPI-only alloc cache that this flushes
+        if (q->page_pool) // otherwise the first open builds it on the new node
+            page_pool_nid_changed(q->page_pool, cpu_to_node(cpu));
+    }
+    rtnl_unlock();
+    return err ? err : count;
+}
+
+static const struct file_operations inzunet_queue_cpu_fops = {
+    .owner   = THIS_MODULE,
+    .open    = inzunet_queue_cpu_open,
+    .read    = seq_read,
+    .llseek  = seq_lseek,
+    .write   = inzunet_queue_cpu_write,
+    .release = single_release,
+};
+
+static void inzunet_debugfs_add(struct net_device *dev)
+{
+    struct inzunet_priv *priv = netdev_priv(dev);
+    struct net *net = dev_net(dev);
+    char name[IFNAMSIZ + 12]; // a u32 inode, the dash and the interface name
+
+    if (net_eq(net, &init_net))
+        strscpy(name, dev->name, sizeof(name));
+    else
+        snprintf(name, sizeof(name), "%u-%s", net->ns.inum, dev->name);
+    priv->debugfs = debugfs_create_dir(name, inzunet_debugfs_root);
+    // the files below then quietly don't get created, at least say so unless debugfs just isn't built in (-ENODEV)
+    if (IS_ERR(priv->debugfs) && PTR_ERR(priv->debugfs) != -ENODEV)
+        netdev_warn(dev, "no debugfs directory %s: %ld\n", name, PTR_ERR(priv->debugfs));
+    debugfs_create_u32("rx_flows", 0644, priv->debugfs, &priv->rx.flows);
+    debugfs_create_u32("rx_burst", 0644, priv->debugfs, &priv->rx.burst);
+    debugfs_create_bool("rx_tcp", 0644, priv->debugfs, &priv->rx.tcp);
+    debugfs_create_file("latency_reset", 0200, priv->debugfs, priv, &inzunet_lat_reset_fops);
+    debugfs_create_file("tx_gen", 0600, priv->debugfs, priv, &inzunet_gen_fops);
+    debugfs_create_u32("tx_gen_pps", 0644, priv->debugfs, &priv->gen_cfg.pps);
+    debugfs_create_u32("tx_gen_size", 0644, priv->debugfs, &priv->gen_cfg.size);
+    debugfs_create_u32("tx_gen_threads", 0644, priv->debugfs, &priv->gen_cfg.threads);
+    debugfs_create_u32("link_mbps", 0644, priv->debugfs, &priv->link.mbps);
+    debugfs_create_u32("link_delay_us", 0644, priv->debugfs, &priv->link.delay_us);
+    debugfs_create_file("queue_cpu", 0644, priv->debugfs, priv, &inzunet_queue_cpu_fops);
+}
+
+// page_pool keeps its own per-CPU counters when the kernel has CONFIG_PAGE_POOL_STATS.
+// hit = allocation served from the pool's cache (or refilled from its recycle ring), miss = had to go to the page allocator,
+// recycle = a freed page made it back into the pool instead of the page allocator.
+static void inzunet_proc_show_pool(struct seq_file *m, struct page_pool *pool)
+{
+#ifdef CONFIG_PAGE_POOL_STATS
+    struct page_pool_stats ps = {};
+
+    if (!pool || !page_pool_get_stats(pool, &ps)) // no pool before the first open
+        return;
+    seq_printf(m, " pool_hit=%llu pool_miss=%llu pool_recycle=%llu pool_recycle_full=%llu",
+               ps.alloc_stats.fast + ps.alloc_stats.refill,
+               ps.alloc_stats.slow + ps.alloc_stats.slow_high_order,
+               ps.recycle_stats.cached + ps.recycle_stats.ring,
+               ps.recycle_stats.cache_full + ps.recycle_stats.ring_full);
+#endif
+}
+
+// "tx_latency: count=N p50<=A p99<=B p999<=C" and the same for RX, then the non empty buckets as "ns_upper_edge=count".
+// All in ns since the last latency_reset, nothing is printed while nothing has been recorded.
+static void inzunet_proc_show_lat_dir(struct seq_file *m, const char *name, const u64 *hist)
+{
+    u64 count = 0;
+    unsigned int b;
+
+    for (b = 0; b < INZUNET_LAT_BUCKETS; b++)
+        count += hist[b];
+    if (!count)
+        return;
+    seq_printf(m, "%s_latency: count=%llu p50<=%llu p99<=%llu p999<=%llu\n", name, count,
+               inzunet_lat_percentile(hist, count, 500), inzunet_lat_percentile(hist, count, 990),
+               inzunet_lat_percentile(hist, count, 999));
+    seq_printf(m, "%s_latency_hist=", name);
+    for (b = 0; b < INZUNET_LAT_BUCKETS; b++)
+        if (hist[b])
+            seq_printf(m, " %llu=%llu", b ? 1ULL << b : 0, hist[b]);
+    seq_putc(m, '\n');
+}
+
+// one line per generator thread of the current or last run, rates averaged over the whole run
+static void inzunet_proc_show_gen(struct seq_file *m, struct inzunet_priv *priv)
+{
+    unsigned int i;
+
+    mutex_lock(&priv->gen_lock);
+    for (i = 0; i < priv->gen_count; i++) {
+        struct inzunet_gen *g = &priv->gen[i];
+        u64 packets, bytes, errors, busy, elapsed;
+        unsigned int start;
+
+        do {
+            start = u64_stats_fetch_begin(&g->syncp);
+            packets = u64_stats_read(&g->packets);
+            bytes = u64_stats_read(&g->bytes);
+            errors = u64_stats_read(&g->errors);
+            busy = u64_stats_read(&g->busy);
+        } while (u64_stats_fetch_retry(&g->syncp, start));
+        elapsed = (g->stop_ns ? g->stop_ns : ktime_get_ns()) - g->start_ns;
+        seq_printf(m, "tx_gen%u: cpu=%u running=%d packets=%llu errors=%llu busy=%llu pps=%llu bps=%llu\n",
+                   i, g->cpu, priv->gen_running, packets, errors, busy,
+                   elapsed ? mul_u64_u64_div_u64(packets, NSEC_PER_SEC, elapsed) : 0,
+                   elapsed ? mul_u64_u64_div_u64(bytes * 8, NSEC_PER_SEC, elapsed) : 0);
+    }
+    mutex_unlock(&priv->gen_lock);
+}
+
+static void inzunet_proc_show_lat(struct seq_file *m, struct inzunet_priv *priv)
+{
+    struct inzunet_lat lat = {};
+
+    inzunet_read_lat(priv, &lat, true);
+    inzunet_proc_show_lat_dir(m, "tx", lat.tx);
+    inzunet_proc_show_lat_dir(m, "rx", lat.rx);
 }
 
 // for /proc files which provides an interface to kernel data and processes, you need to define a show function which prints the contents whenever a user reads it like "cat file"
-static int inzunet_proc_show(struct seq_file *m, void *v)
+static void inzunet_proc_show_dev(struct seq_file *m, struct net_device *dev)
 {
-        struct inzunet_priv *priv; // even if not used immediately, standard is to define all new variables up top
+    struct inzunet_stats stats = {};
+    struct inzunet_priv *priv = netdev_priv(dev);
+    unsigned int i;
+    int b;
+
+    inzunet_read_stats(priv, &stats); // same per-CPU sum "ip -s link" and "ethtool -S" see, kept for scripts that read this file
+    // print each counter on it's own line
+    seq_printf(m,
+               "tx_packets=%llu\ntx_bytes=%llu\ntx_dropped=%llu\nrx_packets=%llu\nrx_bytes=%llu\nrx_dropped=%llu\n",
+               stats.tx_packets,
+               stats.tx_bytes,
+               stats.tx_dropped,
+               stats.rx_packets,
+               stats.rx_bytes,
+               stats.rx_dropped);
+
+    // GRO ratio: wire frames per skb the stack actually processed, 1.00 means GRO merged nothing
+    seq_printf(m, "rx_gro_merged=%llu\n", stats.rx_gro_merged);
+    if (stats.rx_packets > stats.rx_gro_merged) {
+        u64 ratio = div64_u64(stats.rx_packets * 100, stats.rx_packets - stats.rx_gro_merged);
+        u32 frac;
 
-    // if the device is missing, unlikely but safe, output zeros
-        if (!inzunet_dev) {
-                seq_printf(m, "tx_packets=0\ntx_bytes=0\n");
-                return 0;
+        ratio = div_u64_rem(ratio, 100, &frac); // plain 64 bit / and % don't link on 32 bit kernels
+        seq_printf(m, "rx_gro_ratio=%llu.%02u\n", ratio, frac);
+    }
+    inzunet_proc_show_lat(m, priv);
+    inzunet_proc_show_gen(m, priv);
+    seq_printf(m, "tx_ipv4=%llu\ntx_ipv6=%llu\ntx_arp=%llu\ntx_other=%llu\ntx_tcp=%llu\ntx_udp=%llu\ntx_icmp=%llu\n",
+               stats.tx_ipv4, stats.tx_ipv6, stats.tx_arp, stats.tx_other, stats.tx_tcp, stats.tx_udp, stats.tx_icmp);
+    // how much of the time the emulated link kept the stack waiting, the number fq/BQL tuning wants to see
+    seq_printf(m, "link_mbps=%u\nlink_delay_us=%u\ntx_link_stops=%llu\ntx_link_stopped_ns=%llu\n",
+               priv->link_mbps, (u32)div_u64(priv->link_delay_ns, NSEC_PER_USEC), stats.tx_link_stops, stats.tx_link_stopped_ns);
+    seq_printf(m, "xdp_xmit_packets=%llu\nxdp_xmit_bytes=%llu\nxdp_xmit_bulks=%llu\n",
+               stats.xdp_xmit_packets, stats.xdp_xmit_bytes, stats.xdp_xmit_bulks);
+    seq_printf(m, "xsk_tx_packets=%llu\nxsk_tx_bytes=%llu\n", stats.xsk_tx_packets, stats.xsk_tx_bytes);
+    seq_printf(m, "xdp_pass=%llu\nxdp_drop=%llu\nxdp_tx=%llu\nxdp_redirect=%llu\nxdp_aborted=%llu\n",
+               stats.xdp_pass, stats.xdp_drop, stats.xdp_tx, stats.xdp_redirect, stats.xdp_aborted);
+
+    // batch size histogram, "4-7=10" means 10 bursts freed between 4 and 7 skbs at once
+    seq_puts(m, "tx_batch_hist=");
+    for (b = 0; b < INZUNET_BATCH_BUCKETS; b++)
+        seq_printf(m, "%s%u-%u=%llu", b ? " " : "", 1U << b,
+                   min((2U << b) - 1, (unsigned int)INZUNET_TX_BATCH_MAX), stats.tx_batch_hist[b]);
+    seq_putc(m, '\n');
+
+    // then one line per queue so you can see the load is actually spread across CPUs
+    for (i = 0; i < priv->num_queues; i++) {
+        struct inzunet_stats qstats = {};
+
+        inzunet_queue_read_stats(priv->queues[i], &qstats);
+        seq_printf(m, "queue%u: cpu=%u napi_id=%u threaded=%d flows=%u tx_packets=%llu tx_bytes=%llu xdp_xmit_packets=%llu rx_packets=%llu rx_bytes=%llu rx_dropped=%llu rx_gro_merged=%llu",
+                   i, priv->queues[i]->cpu, READ_ONCE(priv->queues[i]->napi.napi_id),
+                   test_bit(NAPI_STATE_THREADED, &priv->queues[i]->napi.state), priv->queues[i]->rx_nflows, qstats.tx_packets, qstats.tx_bytes, qstats.xdp_xmit_packets,
+                   qstats.rx_packets, qstats.rx_bytes, qstats.rx_dropped, qstats.rx_gro_merged);
+        if (rcu_access_pointer(priv->peer))
+            seq_printf(m, " ring=%u/%u tx_ring_full=%llu rx_ring_wakeups=%llu",
+                       inzunet_ring_count(&priv->queues[i]->ring), priv->queues[i]->ring.mask + 1,
+                       qstats.tx_ring_full, qstats.rx_ring_wakeups);
+#ifdef CONFIG_BQL
+        {
+            // BQL's current byte limit and what is in flight against it, the limit adapts so it only means something under load
+            struct dql *dql = &netdev_get_tx_queue(dev, i)->dql;
+
+            seq_printf(m, " bql_limit=%u bql_inflight=%u", READ_ONCE(dql->limit),
+                       READ_ONCE(dql->num_queued) - READ_ONCE(dql->num_completed));
         }
+#endif
+        if (READ_ONCE(priv->queues[i]->xsk_pool))
+            seq_printf(m, " xsk=zerocopy xsk_tx_packets=%llu", qstats.xsk_tx_packets);
+        inzunet_proc_show_pool(m, READ_ONCE(priv->queues[i]->page_pool));
+        seq_putc(m, '\n');
+    }
+}
 
-        priv = netdev_priv(inzunet_dev); // retrieve private counters
-    // print each counter on it's own line
-        seq_printf(m,
-                   "tx_packets=%lld\ntx_bytes=%lld\n",
-                   (long long)atomic64_read(&priv->tx_packets),
-                   (long long)atomic64_read(&priv->tx_bytes));
-        return 0;
+// /proc/net/inzunet/<ifname>, the device is the proc entry's data. The entry is removed (waiting out readers) before the
+// device is unregistered, so it is always valid in here.
+static int inzunet_proc_show_net(struct seq_file *m, void *v)
+{
+    inzunet_proc_show_dev(m, m->private);
+    return 0;
+}
+
+// /proc/inzunet_stats, the old single device file, now shows whichever device was created first
+static int inzunet_proc_show(struct seq_file *m, void *v)
+{
+    struct inzunet_priv *priv;
+
+    // rtnl keeps the device from being unregistered while we print it. The per-device files must never take it, they are
+    // removed under rtnl and that waits for their readers.
+    rtnl_lock();
+    priv = list_first_entry_or_null(&inzunet_devs, struct inzunet_priv, list);
+    if (priv)
+        inzunet_proc_show_dev(m, priv->dev);
+    else
+        seq_printf(m, "tx_packets=0\ntx_bytes=0\n"); // if the device is missing, unlikely but safe, output zeros
+    rtnl_unlock();
+    return 0;
 }
 
 static int inzunet_proc_open(struct inode *inode, struct file *file)
@@ -114,30 +3454,391 @@ static const struct proc_ops inzunet_proc_ops = {
     .proc_release = single_release,
 };
 
+// gives a newly registered (or renamed) device its /proc/net/inzunet/<ifname> file and debugfs directory
+static void inzunet_dev_publish(struct net_device *dev)
+{
+    struct inzunet_priv *priv = netdev_priv(dev);
+    struct inzunet_net *in = net_generic(dev_net(dev), inzunet_net_id);
+
+    if (in->proc_dir)
+        priv->proc = proc_create_single_data(dev->name, 0444, in->proc_dir, inzunet_proc_show_net, dev);
+    inzunet_debugfs_add(dev);
+}
+
+// removes both again, waiting for anyone who has one of the files open to finish
+static void inzunet_dev_unpublish(struct net_device *dev)
+{
+    struct inzunet_priv *priv = netdev_priv(dev);
+
+    proc_remove(priv->proc); // NULL is fine
+    priv->proc = NULL;
+    debugfs_remove_recursive(priv->debugfs);
+    priv->debugfs = NULL;
+}
+
+// every netdev event for every device goes through here, under rtnl. Doing the proc/debugfs work here instead of in
+// init/exit means it follows the device through renames, and covers devices however they are created.
+static int inzunet_netdev_event(struct notifier_block *nb, unsigned long event, void *ptr)
+{
+    struct net_device *dev = netdev_notifier_info_to_dev(ptr);
+
+    // moving to another netns is an UNREGISTER in the old one and a REGISTER in the new one, so the proc file follows
+    if (dev->netdev_ops != &inzunet_netdev_ops)
+        return NOTIFY_DONE; // not one of ours
+    switch (event) {
+    case NETDEV_REGISTER:
+        inzunet_dev_publish(dev);
+        break;
+    case NETDEV_CHANGENAME:
+        inzunet_dev_unpublish(dev);
+        inzunet_dev_publish(dev);
+        break;
+    case NETDEV_UNREGISTER:
+        inzunet_dev_unpublish(dev);
+        break;
+    }
+    return NOTIFY_DONE;
+}
+
+static struct notifier_block inzunet_netdev_notifier = {
+    .notifier_call = inzunet_netdev_event,
+};
+
+// --- netns ---
+
+static int __net_init inzunet_net_init(struct net *net)
+{
+    struct inzunet_net *in = net_generic(net, inzunet_net_id);
+
+    in->proc_dir = proc_mkdir(PROC_DIR_NAME, net->proc_net);
+    if (!in->proc_dir)
+        pr_warn("inzunet: failed to create /proc/net/%s (continuing without it)\n", PROC_DIR_NAME);
+    return 0;
+}
+
+// runs after every device in the netns is gone (device exits run before subsystem exits), so the directory is empty
+static void __net_exit inzunet_net_exit(struct net *net)
+{
+    struct inzunet_net *in = net_generic(net, inzunet_net_id);
+
+    proc_remove(in->proc_dir);
+}
+
+static struct pernet_operations inzunet_net_ops = {
+    .init = inzunet_net_init,
+    .exit = inzunet_net_exit,
+    .id   = &inzunet_net_id,
+    .size = sizeof(struct inzunet_net),
+};
+
+// --- device creation, shared by module load and rtnl_link_ops ---
+
+// queue count a device gets when nobody says otherwise
+static unsigned int inzunet_default_queues(void)
+{
+    return min_t(unsigned int, numqueues ? numqueues : num_online_cpus(), INZUNET_MAX_QUEUES);
+}
+
+// pair ends need the TX queue lock (see inzunet_setup), undo lltx on a device set up before we knew it would be half a pair
+static void inzunet_disable_lltx(struct net_device *dev)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 12, 0)
+    dev->lltx = false;
+#else
+    dev->features &= ~NETIF_F_LLTX;
+#endif
+    if (dev->priv_flags & IFF_NO_QUEUE) {
+        dev->priv_flags &= ~IFF_NO_QUEUE;
+        dev->tx_queue_len = 1000;
+    }
+}
+
+// allocates the other end for dev, same queue count, same netns, same RX settings, and links the two. Not registered yet.
+static struct net_device *inzunet_alloc_peer(struct net_device *dev)
+{
+    struct inzunet_priv *priv = netdev_priv(dev);
+    unsigned int nq = dev->real_num_tx_queues;
+    struct net_device *peer;
+    struct inzunet_priv *peer_priv;
+
+    // same queue count on both ends, TX queue n of one feeds RX queue n of the other
+    peer = alloc_netdev_mqs(sizeof(struct inzunet_priv), "inzunet%d", NET_NAME_ENUM, inzunet_setup, nq, nq);
+    if (!peer)
+        return NULL;
+    peer->rtnl_link_ops = &inzunet_link_ops;
+    dev_net_set(peer, dev_net(dev));
+    peer_priv = netdev_priv(peer);
+    peer_priv->rx = priv->rx;
+    inzunet_disable_lltx(dev);
+    inzunet_disable_lltx(peer);
+    // not registered yet so nobody can be reading these, plain assignment is fine
+    RCU_INIT_POINTER(priv->peer, peer);
+    RCU_INIT_POINTER(peer_priv->peer, dev);
+    return peer;
+}
+
+// napi_threaded=1 does what "echo 1 > /sys/class/net/<dev>/threaded" would right after creation, so the NAPIs start out in
+// their kthreads. Not fatal if it fails (no memory for the threads), the device still works in softirq mode.
+static void inzunet_set_threaded(struct net_device *dev)
+{
+    int err;
+
+    if (!napi_threaded)
+        return;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 17, 0)
+    err = dev_set_threaded(dev, NETDEV_NAPI_THREADED_ENABLED); // became an enum when busy poll threads were added
+#else
+    err = dev_set_threaded(dev, true);
+#endif
+    if (err)
+        netdev_warn(dev, "threaded NAPI not enabled: %d\n", err);
+}
+
+// registers dev and, in pair mode, its peer, called with rtnl held. On failure the peer is taken care of and dev is left
+// for the caller to free_netdev, which is safe even if dev got registered and unregistered again in here.
+static int inzunet_register(struct net_device *dev, struct net_device *peer)
+{
+    int err;
+
+    err = register_netdevice(dev); // registers the device to the kernel networking subsystem
+    if (err) {
+        if (peer)
+            free_netdev(peer); // never registered, ours to free
+        return err;
+    }
+    if (peer) {
+        err = register_netdevice(peer);
+        if (err) {
+            // dev's ndo_uninit unlinks the pair
+            unregister_netdevice(dev);
+            free_netdev(peer);
+            return err;
+        }
+    }
+
+    // pair ends start without carrier, ndo_open turns it on once both are up
+    if (peer) {
+        netif_carrier_off(dev);
+        netif_carrier_off(peer);
+    }
+    list_add_tail(&((struct inzunet_priv *)netdev_priv(dev))->list, &inzunet_devs);
+    inzunet_set_xps(dev);
+    inzunet_set_threaded(dev);
+    if (peer) {
+        list_add_tail(&((struct inzunet_priv *)netdev_priv(peer))->list, &inzunet_devs);
+        inzunet_set_xps(peer);
+        inzunet_set_threaded(peer);
+    }
+    return 0;
+}
+
+// creates and registers one device, or one pair with pair=1, at module load, called with rtnl held
+static int inzunet_create(unsigned int nq)
+{
+    struct net_device *dev, *peer = NULL;
+    int err;
+
+    // allocates a net_device called dev and passes it to inzunet_setup to set it up
+    // the first argument is the size of the private area netdev_priv returns, alloc_netdev_mqs zeroes it. The last two are the number of TX and RX queues,
+    // plain alloc_netdev is the same thing with both set to 1.
+    dev = alloc_netdev_mqs(sizeof(struct inzunet_priv), "inzunet%d", NET_NAME_UNKNOWN, inzunet_setup, nq, nq);
+    if (!dev)
+        return -ENOMEM;
+    // makes it a "type inzunet" link like the ones ip link add creates, so ip link del and netns teardown work on it too
+    dev->rtnl_link_ops = &inzunet_link_ops;
+
+    if (pair) {
+        peer = inzunet_alloc_peer(dev);
+        if (!peer) {
+            free_netdev(dev);
+            return -ENOMEM;
+        }
+    }
+
+    err = inzunet_register(dev, peer);
+    if (err)
+        free_netdev(dev);
+    return err;
+}
+
+// --- rtnl_link_ops ---
+
+static const struct nla_policy inzunet_policy[IFLA_INZUNET_MAX + 1] = {
+    [IFLA_INZUNET_QUEUES] = NLA_POLICY_RANGE(NLA_U32, 1, INZUNET_MAX_QUEUES),
+    [IFLA_INZUNET_RX_PPS] = NLA_POLICY_MIN(NLA_S32, -1),
+    [IFLA_INZUNET_MODE]   = NLA_POLICY_MAX(NLA_U32, INZUNET_MODE_PAIR),
+};
+
+// the policy already range checked our own attributes, this only has to check the generic ones we care about
+static int inzunet_validate(struct nlattr *tb[], struct nlattr *data[], struct netlink_ext_ack *extack)
+{
+    if (tb[IFLA_ADDRESS]) {
+        if (nla_len(tb[IFLA_ADDRESS]) != ETH_ALEN) {
+            NL_SET_ERR_MSG_ATTR(extack, tb[IFLA_ADDRESS], "Invalid MAC address length");
+            return -EINVAL;
+        }
+        if (!is_valid_ether_addr(nla_data(tb[IFLA_ADDRESS]))) {
+            NL_SET_ERR_MSG_ATTR(extack, tb[IFLA_ADDRESS], "Invalid MAC address");
+            return -EADDRNOTAVAIL;
+        }
+    }
+    return 0;
+}
+
+// "ip link add [name X] [numtxqueues N numrxqueues N] type inzunet". The core already allocated dev with inzunet_setup in the
+// netns the request came from (or the one "netns" named), all that's left is applying our attributes and registering.
+// 6.15 folded the arguments into rtnl_newlink_params.
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 15, 0)
+static int inzunet_newlink(struct net_device *dev, struct rtnl_newlink_params *params, struct netlink_ext_ack *extack)
+{
+    struct nlattr **data = params->data;
+#else
+static int inzunet_newlink(struct net *src_net, struct net_device *dev, struct nlattr *tb[], struct nlattr *data[],
+                           struct netlink_ext_ack *extack)
+{
+#endif
+    struct inzunet_priv *priv = netdev_priv(dev);
+    u32 mode = pair ? INZUNET_MODE_PAIR : INZUNET_MODE_SINK;
+    struct net_device *peer = NULL;
+    int err;
+
+    if (data && data[IFLA_INZUNET_QUEUES]) {
+        u32 nq = nla_get_u32(data[IFLA_INZUNET_QUEUES]);
+
+        if (nq > dev->num_tx_queues || nq > dev->num_rx_queues) {
+            NL_SET_ERR_MSG_ATTR(extack, data[IFLA_INZUNET_QUEUES], "More queues than the device was allocated with");
+            return -EINVAL;
+        }
+        err = netif_set_real_num_queues(dev, nq, nq);
+        if (err)
+            return err;
+    }
+    // every queue is both a TX and an RX queue (and in pair mode feeds the peer's RX queue with the same index)
+    if (dev->real_num_tx_queues != dev->real_num_rx_queues) {
+        NL_SET_ERR_MSG(extack, "inzunet needs as many TX queues as RX queues");
+        return -EINVAL;
+    }
+    if (data && data[IFLA_INZUNET_RX_PPS])
+        priv->rx.pps = nla_get_s32(data[IFLA_INZUNET_RX_PPS]);
+    if (data && data[IFLA_INZUNET_MODE])
+        mode = nla_get_u32(data[IFLA_INZUNET_MODE]);
+
+    if (mode == INZUNET_MODE_PAIR) {
+        peer = inzunet_alloc_peer(dev);
+        if (!peer)
+            return -ENOMEM;
+    }
+    return inzunet_register(dev, peer); // on failure the core frees dev
+}
+
+// "ip link del", netns teardown and module unload all come through here. Deleting either end of a pair deletes both, both go
+// on the same kill list so the core unregisters them in one batch. Clearing the peer pointers first makes the other end's
+// dellink (when both are being deleted, e.g. with their netns) queue only itself, queueing a device twice is harmless anyway.
+static void inzunet_dellink(struct net_device *dev, struct list_head *head)
+{
+    struct inzunet_priv *priv = netdev_priv(dev);
+    struct net_device *peer = rtnl_dereference(priv->peer);
+
+    unregister_netdevice_queue(dev, head);
+    if (peer) {
+        struct inzunet_priv *peer_priv = netdev_priv(peer);
+
+        RCU_INIT_POINTER(priv->peer, NULL);
+        RCU_INIT_POINTER(peer_priv->peer, NULL);
+        unregister_netdevice_queue(peer, head);
+    }
+}
+
+static size_t inzunet_get_size(const struct net_device *dev)
+{
+    return nla_total_size(sizeof(u32)) + // IFLA_INZUNET_QUEUES
+           nla_total_size(sizeof(s32)) + // IFLA_INZUNET_RX_PPS
+           nla_total_size(sizeof(u32)); // IFLA_INZUNET_MODE
+}
+
+// what "ip -d link show" gets back in IFLA_INFO_DATA
+static int inzunet_fill_info(struct sk_buff *skb, const struct net_device *dev)
+{
+    struct inzunet_priv *priv = netdev_priv(dev);
+    u32 mode = rcu_access_pointer(priv->peer) ? INZUNET_MODE_PAIR : INZUNET_MODE_SINK;
+
+    if (nla_put_u32(skb, IFLA_INZUNET_QUEUES, priv->num_queues) ||
+        nla_put_s32(skb, IFLA_INZUNET_RX_PPS, priv->rx.pps) ||
+        nla_put_u32(skb, IFLA_INZUNET_MODE, mode))
+        return -EMSGSIZE;
+    return 0;
+}
+
+// a pair's ends can live in different netns, this tells netlink dumps where the other end is
+static struct net *inzunet_get_link_net(const struct net_device *dev)
+{
+    struct inzunet_priv *priv = netdev_priv(dev);
+    struct net_device *peer = rtnl_dereference(priv->peer);
+
+    return peer ? dev_net(peer) : dev_net(dev);
+}
+
+static unsigned int inzunet_get_num_queues(void)
+{
+    return inzunet_default_queues();
+}
+
+static struct rtnl_link_ops inzunet_link_ops = {
+    .kind              = "inzunet",
+    .priv_size         = sizeof(struct inzunet_priv),
+    .setup             = inzunet_setup,
+    .maxtype           = IFLA_INZUNET_MAX,
+    .policy            = inzunet_policy,
+    .validate          = inzunet_validate,
+    .newlink           = inzunet_newlink,
+    .dellink           = inzunet_dellink,
+    .get_size          = inzunet_get_size,
+    .fill_info         = inzunet_fill_info,
+    .get_link_net      = inzunet_get_link_net,
+    .get_num_tx_queues = inzunet_get_num_queues, // without numtxqueues/numrxqueues, same default as module load
+    .get_num_rx_queues = inzunet_get_num_queues,
+};
+
 // module initialization funciton, not required but your code is useless unless you have an init function. Your module would only be useful really to provide helper
 // functionality.
 // __init is a macro that tells the kernel that the function is only needed during initialization and the memory for it can be freed afterwards
 static int __init inzunet_init(void)
 {
+    unsigned int nq = inzunet_default_queues();
+    unsigned int i;
     int err;
-    struct inzunet_priv *priv;
 
-    // allocates a net_device called dev and passes it to inzunet_setup to set it up and then returns that dev here which we assign to our already declared inzunet_dev
-    inzunet_dev = alloc_netdev(0, "inzunet%d", NET_NAME_UNKNOWN, inzunet_setup);
-        struct inzunet_priv *priv;
-    if (!inzunet_dev)
-        return -ENOMEM;
+    numdevs = min_t(unsigned int, numdevs, INZUNET_MAX_DEVS);
 
-        // initialize priv counters to zero
-    priv = netdev_priv(inzunet_dev);
-        atomic64_set(&priv->tx_packets, 0);
-        atomic64_set(&priv->tx_bytes, 0);
+    // unbound so the queued page pool teardowns run in parallel, not one per CPU at a time
+    inzunet_wq = alloc_workqueue("inzunet_free", WQ_UNBOUND, 0);
+    if (!inzunet_wq) {
+        err = -ENOMEM;
+        goto err_cap;
+    }
+    // the places each device shows up in, the notifier fills them in as devices register
+    inzunet_debugfs_root = debugfs_create_dir("inzunet", NULL);
+    err = register_pernet_subsys(&inzunet_net_ops); // runs inzunet_net_init for every netns, now and later
+    if (err)
+        goto err_debugfs;
+    err = register_netdevice_notifier(&inzunet_netdev_notifier);
+    if (err)
+        goto err_pernet;
+    err = misc_register(&inzunet_cap_dev);
+    if (err)
+        goto err_notifier;
+    err = rtnl_link_register(&inzunet_link_ops);
+    if (err)
+        goto err_misc;
 
-    err = register_netdev(inzunet_dev); // registers the device to the kernel networking subsystem
+    // all devices are registered under one rtnl_lock so no one ever sees half a pair
+    rtnl_lock();
+    for (i = 0; i < numdevs && !err; i++)
+        err = inzunet_create(nq);
+    rtnl_unlock();
     if (err) {
         pr_err("inzunet: register_netdev failed: %d\n", err);
-        free_netdev(inzunet_dev); // free the net_device if it failed to register
-        return err;
+        goto err_link; // unregistering the link ops deletes the ones that did register
     }
 
         // create /proc entry at /proc/inzunet_stats
@@ -147,8 +3848,23 @@ static int __init inzunet_init(void)
                 /* not fatal - continue (but user won't have stats via /proc) */
         }
 
-    pr_info("inzunet: module loaded, device=%s\n", inzunet_dev->name);
+    pr_info("inzunet: module loaded, %u %s queues=%u\n", numdevs, pair ? "pairs" : "devices", nq);
     return 0;
+
+err_link:
+    rtnl_link_unregister(&inzunet_link_ops);
+err_misc:
+    misc_deregister(&inzunet_cap_dev);
+err_notifier:
+    unregister_netdevice_notifier(&inzunet_netdev_notifier);
+err_pernet:
+    unregister_pernet_subsys(&inzunet_net_ops);
+err_debugfs:
+    debugfs_remove_recursive(inzunet_debugfs_root);
+    destroy_workqueue(inzunet_wq); // waits for the queues of devices that did register
+err_cap:
+    inzunet_cap_free();
+    return err;
 }
 
 // module cleanup function, is required.
@@ -161,11 +3877,17 @@ static void __exit inzunet_exit(void)
                 inzunet_proc_entry = NULL;
         }
 
-    if (inzunet_dev) { // remove inzunet net device if created
-        unregister_netdev(inzunet_dev);
-        free_netdev(inzunet_dev);
-        pr_info("inzunet: module unloaded\n");
-    }
+    // deletes every inzunet device in every netns through inzunet_dellink, all in one batch, the notifier removes each
+    // device's proc file and debugfs dir as it goes
+    rtnl_link_unregister(&inzunet_link_ops);
+    misc_deregister(&inzunet_cap_dev);
+    inzunet_cap_free();
+    unregister_netdevice_notifier(&inzunet_netdev_notifier);
+    unregister_pernet_subsys(&inzunet_net_ops);
+    debugfs_remove_recursive(inzunet_debugfs_root);
+    // every device is gone, this waits for the last page pools to be destroyed before our code goes away
+    destroy_workqueue(inzunet_wq);
+    pr_info("inzunet: module unloaded\n");
 }
 
 module_init(inzunet_init);
@@ -173,3 +3895,4 @@ module_exit(inzunet_exit);
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Sergio Inzunza");
 MODULE_DESCRIPTION("Minimal virtual NIC for learning");
+MODULE_ALIAS_RTNL_LINK("inzunet"); // lets "ip link add type inzunet" load the module on demand
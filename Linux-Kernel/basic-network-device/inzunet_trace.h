@@ -0,0 +1,59 @@
+// Static tracepoints for inzunet. They cost a single patched-out branch until someone enables them, for example:
+//   echo 1 > /sys/kernel/tracing/events/inzunet/enable && cat /sys/kernel/tracing/trace_pipe
+// or "perf record -e inzunet:inzunet_xmit". This header is read several times by the tracing macros, which is why the
+// include guard below looks unusual, and inzunet.c defines CREATE_TRACE_POINTS before including it exactly once.
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM inzunet
+
+#if !defined(_INZUNET_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _INZUNET_TRACE_H
+
+#include <linux/netdevice.h>
+#include <linux/skbuff.h>
+#include <linux/tracepoint.h>
+
+// both events record the same fields, so they share one class
+DECLARE_EVENT_CLASS(inzunet_packet,
+
+    TP_PROTO(const struct net_device *dev, const struct sk_buff *skb, u16 queue),
+
+    TP_ARGS(dev, skb, queue),
+
+    TP_STRUCT__entry(
+        __array(char, name, IFNAMSIZ)
+        __field(unsigned int, len)
+        __field(u16, protocol)
+        __field(u16, queue)
+    ),
+
+    TP_fast_assign(
+        memcpy(__entry->name, dev->name, IFNAMSIZ);
+        __entry->len = skb->len;
+        __entry->protocol = ntohs(skb->protocol);
+        __entry->queue = queue;
+    ),
+
+    TP_printk("dev=%s queue=%u len=%u proto=0x%04x",
+              __entry->name, __entry->queue, __entry->len, __entry->protocol)
+);
+
+// fired for every packet handed to inzunet_start_xmit
+DEFINE_EVENT(inzunet_packet, inzunet_xmit,
+    TP_PROTO(const struct net_device *dev, const struct sk_buff *skb, u16 queue),
+    TP_ARGS(dev, skb, queue)
+);
+
+// fired for every packet the RX side hands up to the stack
+DEFINE_EVENT(inzunet_packet, inzunet_rx,
+    TP_PROTO(const struct net_device *dev, const struct sk_buff *skb, u16 queue),
+    TP_ARGS(dev, skb, queue)
+);
+
+#endif // _INZUNET_TRACE_H
+
+// these must stay outside the include guard, define_trace.h uses them to find this file again
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE inzunet_trace
+#include <trace/define_trace.h>